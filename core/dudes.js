@@ -95,7 +95,8 @@ class Dudes extends Group {
           ) {
             return;
           }
-          obstacles[voxel.z * world.width * world.height + voxel.y * world.width + voxel.x] = 1;
+          const index = voxel.z * world.width * world.height + voxel.y * world.width + voxel.x;
+          obstacles[index >> 3] |= 1 << (index & 7);
           voxel.y += 1;
         }
       }
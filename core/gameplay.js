@@ -15,6 +15,8 @@ import Explosion from '../renderables/explosion.js';
 import Spheres from '../renderables/spheres.js';
 import VoxelChunk from '../renderables/chunk.js';
 
+const _camera = new Vector3();
+
 class Gameplay extends Group {
   constructor(scene, {
     ambient = {
@@ -222,6 +224,7 @@ class Gameplay extends Group {
         .then((options) => (
           new Promise((resolve) => {
             const world = new VoxelWorld({
+              colliderRegion: 2,
               ...options,
               onLoad: () => {
                 if (options.voxels) {
@@ -312,34 +315,55 @@ class Gameplay extends Group {
       y: world.height / world.chunkSize,
       z: world.depth / world.chunkSize,
     };
-    for (let z = 0; z < this.chunks.z; z += 1) {
+    this.lodChunk = this.getPlayerChunk();
+    this.visibilityChunk = new Vector3();
+    this.needsVisibility = true;
+    const list = this.getChunks();
+    const geometries = world.meshChunks(list);
+    for (let z = 0, i = 0; z < this.chunks.z; z += 1) {
       for (let y = 0; y < this.chunks.y; y += 1) {
-        for (let x = 0; x < this.chunks.x; x += 1) {
+        for (let x = 0; x < this.chunks.x; x += 1, i += 1) {
           const chunk = new VoxelChunk({
             x: x * world.chunkSize,
             y: y * world.chunkSize,
             z: z * world.chunkSize,
-            geometry: world.mesh(x, y, z),
+            geometry: geometries[i],
             scale: world.scale,
           });
-          if (physics) {
-            chunk.collider = new Group();
-            chunk.collider.isChunk = true;
-            chunk.collider.position.copy(chunk.position);
-            chunk.collider.physics = [];
-            if (options.world.onContact) {
-              chunk.collider.onContact = options.world.onContact;
-            }
-          }
+          chunk.lod = list[i].lod;
+          chunk.connections = geometries[i].connections;
           world.meshes.push(chunk);
           if (chunk.geometry.getIndex() !== null) {
             world.chunks.add(chunk);
-            if (physics) {
-              this.updateCollider(chunk.collider, world.colliders(x, y, z), true);
+          }
+        }
+      }
+    }
+    if (physics) {
+      // A collider per region of colliderRegion chunks per side,
+      // so the physics get fewer static bodies with boxes that span across chunks
+      const size = world.chunkSize * world.colliderRegion;
+      this.regions = {
+        x: Math.ceil(world.width / size),
+        y: Math.ceil(world.height / size),
+        z: Math.ceil(world.depth / size),
+      };
+      this.colliders = [];
+      for (let z = 0; z < this.regions.z; z += 1) {
+        for (let y = 0; y < this.regions.y; y += 1) {
+          for (let x = 0; x < this.regions.x; x += 1) {
+            const collider = new Group();
+            collider.isChunk = true;
+            collider.position.set(x, y, z).multiplyScalar(size * world.scale);
+            collider.physics = [];
+            if (options.world.onContact) {
+              collider.onContact = options.world.onContact;
             }
+            this.colliders.push(collider);
           }
         }
       }
+      this.updateColliders();
     }
 
     if (server) {
@@ -404,6 +428,8 @@ class Gameplay extends Group {
     if (!hasLoaded) {
       return;
     }
+    this.updateLOD();
+    this.updateVisibility(camera);
     ambient.animate(animation);
     birds.animate(animation);
     clouds.animate(animation);
@@ -458,31 +484,59 @@ class Gameplay extends Group {
     }
   }
 
+  getChunks() {
+    const { chunks } = this;
+    const list = [];
+    for (let z = 0; z < chunks.z; z += 1) {
+      for (let y = 0; y < chunks.y; y += 1) {
+        for (let x = 0; x < chunks.x; x += 1) {
+          list.push({ x, y, z, lod: this.getLOD(x, y, z) });
+        }
+      }
+    }
+    return list;
+  }
+
+  getLOD(x, y, z) {
+    const { lodChunk, world: { chunkSize, lodDistances } } = this;
+    const distance = lodChunk.distanceTo({ x, y, z }) * chunkSize;
+    let lod = 0;
+    while (lod < Math.min(lodDistances.length, 2) && distance > lodDistances[lod]) {
+      lod += 1;
+    }
+    return lod;
+  }
+
+  getPlayerChunk() {
+    const { player, world } = this;
+    return (new Vector3())
+      .copy(player.position)
+      .divideScalar(world.scale * world.chunkSize)
+      .floor();
+  }
+
   remesh() {
     const { chunks, world } = this;
+    const list = this.getChunks();
+    const geometries = world.meshChunks(list);
     for (let z = 0, i = 0; z < chunks.z; z += 1) {
       for (let y = 0; y < chunks.y; y += 1) {
         for (let x = 0; x < chunks.x; x += 1, i += 1) {
           const mesh = world.meshes[i];
-          if (mesh.collider) {
-            mesh.collider.physics.length = 0;
-          }
-          const geometry = world.mesh(x, y, z);
-          if (geometry.indices.length > 0) {
+          mesh.lod = list[i].lod;
+          const geometry = geometries[i];
+          mesh.connections = geometry.connections;
+          if (geometry.vertices.length > 0) {
             mesh.update(geometry);
-            if (mesh.collider) {
-              this.updateCollider(mesh.collider, world.colliders(x, y, z));
-            }
             if (!mesh.parent) world.chunks.add(mesh);
           } else if (mesh.parent) {
             world.chunks.remove(mesh);
-            if (mesh.collider) {
-              this.updateCollider(mesh.collider, []);
-            }
           }
         }
       }
     }
+    this.updateColliders();
+    this.needsVisibility = true;
   }
 
   resumeAudio() {
@@ -529,22 +583,53 @@ class Gameplay extends Group {
     }
   }
 
-  updateCollider(collider, boxes, force) {
-    const { physics, world } = this;
-    if (!force && collider.physics.length === boxes.length / 6) {
-      // This is kind of a hack.
-      // It will cause bugs since it could happen that the volume changed
-      // but the count of resulting boxes is the same.
-      // I need to think of a safer way to optimize this.
+  // Updates the colliders of the regions with any of the chunks (default: all the regions)
+  updateColliders(chunks) {
+    const { colliders, regions, world } = this;
+    if (!colliders) {
       return;
     }
-    if (collider.physics.length) {
-      physics.removeMesh(collider);
-      collider.physics.length = 0;
+    if (!chunks) {
+      for (let z = 0, i = 0; z < regions.z; z += 1) {
+        for (let y = 0; y < regions.y; y += 1) {
+          for (let x = 0; x < regions.x; x += 1, i += 1) {
+            this.updateCollider(colliders[i], world.colliders(x, y, z));
+          }
+        }
+      }
+      return;
     }
-    if (boxes.length) {
-      for (let i = 0, l = boxes.length; i < l; i += 6) {
-        collider.physics.push({
+    const updated = new Set();
+    chunks.forEach(({ x, y, z }) => {
+      x = Math.floor(x / world.colliderRegion);
+      y = Math.floor(y / world.colliderRegion);
+      z = Math.floor(z / world.colliderRegion);
+      const i = z * regions.x * regions.y + y * regions.x + x;
+      if (!updated.has(i)) {
+        updated.add(i);
+        this.updateCollider(colliders[i], world.colliders(x, y, z));
+      }
+    });
+  }
+
+  // Only adds & removes the boxes that changed (by their position & size).
+  // (The hash can collide, so it's never used to skip the diff)
+  updateCollider(collider, { boxes }) {
+    const { physics, world } = this;
+    const previous = new Map(collider.physics.map((box) => [box.key, box]));
+    const hadBoxes = previous.size > 0;
+    const added = [];
+    collider.physics = [];
+    for (let i = 0, l = boxes.length; i < l; i += 6) {
+      const key = boxes[i] + 256 * (boxes[i + 1] + 256 * (boxes[i + 2] + 256 * (
+        boxes[i + 3] + 256 * (boxes[i + 4] + 256 * boxes[i + 5])
+      )));
+      let box = previous.get(key);
+      if (box) {
+        previous.delete(key);
+      } else {
+        box = {
+          key,
           shape: 'box',
           width: boxes[i + 3] * world.scale,
           height: boxes[i + 4] * world.scale,
@@ -554,9 +639,61 @@ class Gameplay extends Group {
             y: (boxes[i + 1] + boxes[i + 4] * 0.5) * world.scale,
             z: (boxes[i + 2] + boxes[i + 5] * 0.5) * world.scale,
           },
-        });
+        };
+        added.push(box);
       }
-      physics.addMesh(collider, { isTrigger: !!collider.onContact });
+      collider.physics.push(box);
+    }
+    if (!hadBoxes) {
+      if (added.length) {
+        physics.addMesh(collider, { isTrigger: !!collider.onContact });
+      }
+    } else if (!collider.physics.length) {
+      physics.removeMesh(collider);
+    } else if (added.length || previous.size) {
+      physics.updateShapes(collider, {
+        add: added,
+        remove: [...previous.values()],
+      });
+    }
+  }
+
+  updateLOD() {
+    const { chunks, lodChunk, world } = this;
+    if (!world.lodDistances.length) {
+      return;
+    }
+    const chunk = this.getPlayerChunk();
+    if (chunk.equals(lodChunk)) {
+      return;
+    }
+    lodChunk.copy(chunk);
+    const changed = [];
+    for (let z = 0, i = 0; z < chunks.z; z += 1) {
+      for (let y = 0; y < chunks.y; y += 1) {
+        for (let x = 0; x < chunks.x; x += 1, i += 1) {
+          const lod = this.getLOD(x, y, z);
+          if (world.meshes[i].lod !== lod) {
+            changed.push({ x, y, z, lod });
+          }
+        }
+      }
+    }
+    const geometries = world.meshChunks(changed);
+    changed.forEach(({ x, y, z, lod }, i) => {
+      const mesh = world.meshes[z * chunks.x * chunks.y + y * chunks.x + x];
+      const geometry = geometries[i];
+      mesh.lod = lod;
+      mesh.connections = geometry.connections;
+      if (geometry.vertices.length > 0) {
+        mesh.update(geometry);
+        if (!mesh.parent) world.chunks.add(mesh);
+      } else if (mesh.parent) {
+        world.chunks.remove(mesh);
+      }
+    });
+    if (changed.length) {
+      this.needsVisibility = true;
     }
   }
 
@@ -592,6 +729,89 @@ class Gameplay extends Group {
     ambient.sounds.find(({ url }) => url === '/sounds/rain.ogg').enabled = rain.visible;
   }
 
+  // Hides the chunks that can't be seen from the chunk of the camera.
+  // Breadth first from there: it only moves away from the camera (never against
+  // a direction it already took) and it only goes through a chunk between
+  // sides that are connected by its air (see VoxelWorld.meshChunks).
+  // A chunk gets visited once per side it's entered through, since what
+  // can be seen past it depends on where it was entered from.
+  updateVisibility(camera) {
+    const { chunks, visibilityChunk, world } = this;
+    const { meshes } = world;
+    const chunk = _camera
+      .setFromMatrixPosition(camera.matrixWorld)
+      .divideScalar(world.scale * world.chunkSize)
+      .floor();
+    if (!this.needsVisibility && chunk.equals(visibilityChunk)) {
+      return;
+    }
+    this.needsVisibility = false;
+    visibilityChunk.copy(chunk);
+    if (
+      chunk.x < 0 || chunk.x >= chunks.x
+      || chunk.y < 0 || chunk.y >= chunks.y
+      || chunk.z < 0 || chunk.z >= chunks.z
+    ) {
+      meshes.forEach((mesh) => { mesh.visible = true; });
+      return;
+    }
+    // Bitmask of the sides each chunk was entered through (64: the camera chunk)
+    const visited = new Uint8Array(meshes.length);
+    const queue = [{
+      x: chunk.x,
+      y: chunk.y,
+      z: chunk.z,
+      from: -1,
+      directions: 0,
+    }];
+    visited[chunk.z * chunks.x * chunks.y + chunk.y * chunks.x + chunk.x] = 64;
+    for (let i = 0; i < queue.length; i += 1) {
+      const {
+        x,
+        y,
+        z,
+        from,
+        directions,
+      } = queue[i];
+      const { connections } = meshes[z * chunks.x * chunks.y + y * chunks.x + x];
+      Gameplay.chunkSides.forEach(({ x: dx, y: dy, z: dz }, side) => {
+        if (
+          (directions & (1 << (side ^ 1)))
+          || (
+            from !== -1
+            && !((connections >> (Math.min(from, side) * 6 + Math.max(from, side))) & 1)
+          )
+        ) {
+          return;
+        }
+        const nx = x + dx;
+        const ny = y + dy;
+        const nz = z + dz;
+        if (
+          nx < 0 || nx >= chunks.x
+          || ny < 0 || ny >= chunks.y
+          || nz < 0 || nz >= chunks.z
+        ) {
+          return;
+        }
+        const neighbor = nz * chunks.x * chunks.y + ny * chunks.x + nx;
+        const entry = 1 << (side ^ 1);
+        if (visited[neighbor] & entry) {
+          return;
+        }
+        visited[neighbor] |= entry;
+        queue.push({
+          x: nx,
+          y: ny,
+          z: nz,
+          from: side ^ 1,
+          directions: directions | (1 << side),
+        });
+      });
+    }
+    meshes.forEach((mesh, i) => { mesh.visible = visited[i] !== 0; });
+  }
+
   updateVoxel(brush, voxel, broadcast = true) {
     const {
       chunks,
@@ -599,54 +819,60 @@ class Gameplay extends Group {
       server,
       world,
     } = this;
-    const noise = ((brush.color.r + brush.color.g + brush.color.b) / 3) * brush.noise;
     const shape = typeof brush.shape === 'number' ? brush.shape : VoxelWorld.brushShapes[brush.shape];
     const type = typeof brush.type === 'number' ? brush.type : VoxelWorld.blockTypes[brush.type];
-    VoxelWorld.getBrush({
+    const color = brush.color.getHex();
+    const seed = brush.seed || VoxelWorld.brushSeed();
+    world.brush({
       shape,
       size: brush.size,
-    }).forEach(({ x, y, z }) => (
-      world.update({
-        x: voxel.x + x,
-        y: voxel.y + y,
-        z: voxel.z + z,
-        type,
-        r: Math.min(Math.max((brush.color.r + (Math.random() - 0.5) * noise) * 0xFF, 0), 0xFF),
-        g: Math.min(Math.max((brush.color.g + (Math.random() - 0.5) * noise) * 0xFF, 0), 0xFF),
-        b: Math.min(Math.max((brush.color.b + (Math.random() - 0.5) * noise) * 0xFF, 0), 0xFF),
-      })
-    ));
-    const chunkX = Math.floor(voxel.x / world.chunkSize);
-    const chunkY = Math.floor(voxel.y / world.chunkSize);
-    const chunkZ = Math.floor(voxel.z / world.chunkSize);
-    const topY = Math.min(chunkY + 1, chunks.y - 1);
-    Gameplay.chunkNeighbors.forEach((neighbor) => {
-      const x = chunkX + neighbor.x;
-      const z = chunkZ + neighbor.z;
-      if (x < 0 || x >= chunks.x || z < 0 || z >= chunks.z) {
-        return;
+      type,
+      x: voxel.x,
+      y: voxel.y,
+      z: voxel.z,
+      r: (color >> 16) & 0xFF,
+      g: (color >> 8) & 0xFF,
+      b: color & 0xFF,
+      noise: brush.noise,
+      seed,
+    });
+    // Chunks where only the light changed get their vertices relit in place
+    const dirty = world.getDirtyChunks().filter(({
+      x,
+      y,
+      z,
+      mesh: remesh,
+      light,
+    }) => {
+      if (remesh || !light) {
+        return true;
       }
-      for (let y = 0; y <= topY; y += 1) {
-        const mesh = world.meshes[z * chunks.x * chunks.y + y * chunks.x + x];
-        const geometry = world.mesh(x, y, z);
-        if (geometry.indices.length > 0) {
-          mesh.update(geometry);
-          if (mesh.collider && Math.abs(chunkY - y) <= 1) {
-            this.updateCollider(
-              mesh.collider,
-              world.colliders(x, y, z),
-              x === chunkX && y === chunkY && z === chunkZ
-            );
-          }
-          if (!mesh.parent) world.chunks.add(mesh);
-        } else if (mesh.parent) {
-          world.chunks.remove(mesh);
-          if (mesh.collider) {
-            this.updateCollider(mesh.collider, []);
-          }
-        }
+      const mesh = world.meshes[z * chunks.x * chunks.y + y * chunks.x + x];
+      return mesh.parent && !mesh.updateLight((vertices, light) => (
+        world.relight(x, y, z, mesh.lod, vertices, light)
+      ));
+    });
+    const geometries = world.meshChunks(dirty.map(({ x, y, z }) => ({
+      x,
+      y,
+      z,
+      lod: world.meshes[z * chunks.x * chunks.y + y * chunks.x + x].lod,
+    })));
+    dirty.forEach(({ x, y, z }, i) => {
+      const mesh = world.meshes[z * chunks.x * chunks.y + y * chunks.x + x];
+      const geometry = geometries[i];
+      mesh.connections = geometry.connections;
+      if (geometry.vertices.length > 0) {
+        mesh.update(geometry);
+        if (!mesh.parent) world.chunks.add(mesh);
+      } else if (mesh.parent) {
+        world.chunks.remove(mesh);
       }
     });
+    this.updateColliders(dirty.filter(({ colliders }) => colliders));
+    if (dirty.length) {
+      this.needsVisibility = true;
+    }
     dudes.revaluatePaths();
     // this.physics.wakeAll();
     if (server && broadcast) {
@@ -658,22 +884,21 @@ class Gameplay extends Group {
           type,
           shape,
           color: brush.color.getHex(),
+          seed,
         },
       });
     }
   }
 }
 
-Gameplay.chunkNeighbors = [
-  { x: -1, z: -1 },
-  { x: 0, z: -1 },
-  { x: 1, z: -1 },
-  { x: -1, z: 0 },
-  { x: 0, z: 0 },
-  { x: 1, z: 0 },
-  { x: -1, z: 1 },
-  { x: 0, z: 1 },
-  { x: 1, z: 1 },
+// Chunk sides in the order of the mesher: top, bottom, south, north, east & west
+Gameplay.chunkSides = [
+  { x: 0, y: 1, z: 0 },
+  { x: 0, y: -1, z: 0 },
+  { x: 0, y: 0, z: 1 },
+  { x: 0, y: 0, z: -1 },
+  { x: 1, y: 0, z: 0 },
+  { x: -1, y: 0, z: 0 },
 ];
 
 export default Gameplay;
@@ -3,6 +3,7 @@ import { Vector3, Quaternion } from '../vendor/three.js';
 class Physics {
   constructor(onLoad) {
     this.bodies = new WeakMap();
+    this.shapes = new WeakMap();
     this.constraints = [];
     this.dynamic = [];
     this.kinematic = [];
@@ -359,25 +360,11 @@ class Physics {
   }
 
   createShape(physics) {
-    const { aux: { transform, quaternion, vector }, runtime: Ammo } = this;
+    const { aux: { vector }, runtime: Ammo } = this;
 
     if (Array.isArray(physics)) {
       const compound = new Ammo.btCompoundShape();
-      physics.forEach((physics) => {
-        const shape = this.createShape(physics);
-        if (shape) {
-          transform.setIdentity();
-          if (physics.position) {
-            vector.setValue(physics.position.x, physics.position.y, physics.position.z);
-            transform.setOrigin(vector);
-          }
-          if (physics.rotation) {
-            quaternion.setValue(physics.rotation.x, physics.rotation.y, physics.rotation.z, physics.rotation.w);
-            transform.setRotation(quaternion);
-          }
-          compound.addChildShape(transform, shape);
-        }
-      });
+      physics.forEach((physics) => this.addChildShape(compound, physics));
       return compound;
     }
 
@@ -413,6 +400,44 @@ class Physics {
     return shape;
   }
 
+  addChildShape(compound, physics) {
+    const { aux: { transform, quaternion, vector }, shapes } = this;
+    const shape = this.createShape(physics);
+    if (!shape) {
+      return;
+    }
+    transform.setIdentity();
+    if (physics.position) {
+      vector.setValue(physics.position.x, physics.position.y, physics.position.z);
+      transform.setOrigin(vector);
+    }
+    if (physics.rotation) {
+      quaternion.setValue(physics.rotation.x, physics.rotation.y, physics.rotation.z, physics.rotation.w);
+      transform.setRotation(quaternion);
+    }
+    compound.addChildShape(transform, shape);
+    shapes.set(physics, shape);
+  }
+
+  // Adds & removes shapes of a mesh with a compound shape (an array of shapes in mesh.physics)
+  // without recreating its body. The removed ones must be the same objects that were added.
+  updateShapes(mesh, { add = [], remove = [] }) {
+    const { runtime: Ammo, shapes } = this;
+    const body = this.getBody(mesh);
+    if (!body || !(body.shape instanceof Ammo.btCompoundShape)) {
+      return;
+    }
+    remove.forEach((physics) => {
+      const shape = shapes.get(physics);
+      if (shape) {
+        body.shape.removeChildShape(shape);
+        shapes.delete(physics);
+        Ammo.destroy(shape);
+      }
+    });
+    add.forEach((physics) => this.addChildShape(body.shape, physics));
+  }
+
   getBody(mesh, instance) {
     const { bodies } = this;
     if (mesh.isInstancedMesh) {
@@ -64,14 +64,15 @@ class Voxelizer {
         });
       };
       model.matrixAutoUpdate = false;
-      for (let z = 0; z < chunks.z; z += 1) {
+      const geometries = world.meshChunks();
+      for (let z = 0, i = 0; z < chunks.z; z += 1) {
         for (let y = 0; y < chunks.y; y += 1) {
-          for (let x = 0; x < chunks.x; x += 1) {
+          for (let x = 0; x < chunks.x; x += 1, i += 1) {
             const chunk = new VoxelChunk({
               x: offset.x + x * world.chunkSize,
               y: offset.y + y * world.chunkSize,
               z: offset.z + z * world.chunkSize,
-              geometry: world.mesh(x, y, z),
+              geometry: geometries[i],
               scale,
             });
             if (chunk.geometry.getIndex() === null) {
@@ -81,7 +82,7 @@ class Voxelizer {
             if (!colliders) {
               continue;
             }
-            const boxes = world.colliders(x, y, z);
+            const { boxes } = world.colliders(x, y, z);
             if (!boxes.length) {
               continue;
             }
@@ -8,9 +8,36 @@ class VoxelWorld {
     chunkSize = 16,
     generator = 'default',
     seed = Math.floor(Math.random() * 2147483647),
+    storage = 'linear',
+    maxBricks,
+    greedyMeshing = false,
+    lodDistances = [],
+    colliderRegion = 1,
     onLoad,
   }) {
     this.chunkSize = chunkSize;
+    // Chunks per side of the regions covered by every call to colliders
+    this.colliderRegion = colliderRegion;
+    const colliderSize = chunkSize * colliderRegion;
+    if (colliderSize > 255) {
+      throw new Error('The collider regions must be under 256 voxels per side');
+    }
+    this.greedyMeshing = greedyMeshing;
+    this.lodDistances = lodDistances;
+    this.storage = typeof storage === 'number' ? storage : VoxelWorld.storages[storage];
+    if (this.storage === VoxelWorld.storages.bricked || this.storage === VoxelWorld.storages.sparse) {
+      if (
+        (chunkSize & (chunkSize - 1)) !== 0
+        || width % chunkSize !== 0
+        || height % chunkSize !== 0
+        || depth % chunkSize !== 0
+      ) {
+        throw new Error('Bricked & sparse storages require a power of two chunkSize and the volume to be a multiple of it');
+      }
+      this.brickSize = chunkSize;
+    } else {
+      this.brickSize = 0;
+    }
     this.generator = typeof generator === 'function' ? generator : VoxelWorld.generators[generator];
     this.seed = seed;
     this.seaLevel = seaLevel;
@@ -21,29 +48,84 @@ class VoxelWorld {
     // worst possible case
     const maxVoxelsPerChunk = Math.ceil(chunkSize * chunkSize * chunkSize * 0.5);
     const maxFacesPerChunk = maxVoxelsPerChunk * 6;
+    const maxVoxelsPerRegion = Math.ceil(colliderSize * colliderSize * colliderSize * 0.5);
+    // meshChunks packs as many chunks as it can into the vertices,
+    // so with room for two worst cases every batch gets at least one worst case worth of faces
+    this.meshCapacity = maxFacesPerChunk * 2;
+    const volume = width * height * depth;
     const queueSize = width * depth * 3;
+    const chunks = (width / chunkSize) * (height / chunkSize) * (depth / chunkSize);
+    const isSparse = this.storage === VoxelWorld.storages.sparse;
+    const bricks = isSparse ? volume / (chunkSize ** 3) : 0;
+    // The sparse storage starts with a slot per column of bricks and grows its pool
+    // (up to maxBricks slots, default: one per brick) when generating, loading or editing
+    // the world runs out of them. So it ends up sized by the unique bricks of the world.
+    this.maxBricks = isSparse ? Math.min(maxBricks || bricks, bricks) : 0;
+    const capacity = isSparse ? Math.min((width / chunkSize) * (depth / chunkSize) + 1, this.maxBricks) : 0;
+    this.cells = isSparse ? 0 : volume;
     const layout = [
-      { id: 'voxels', type: Uint8Array, size: width * height * depth * 6 },
-      { id: 'colliderBoxes', type: Uint8Array, size: maxVoxelsPerChunk * 6 },
-      { id: 'colliderMap', type: Uint8Array, size: chunkSize * chunkSize * chunkSize },
-      { id: 'obstaclesMap', type: Uint8Array, size: width * height * depth },
-      { id: 'vertices', type: Uint8Array, size: maxFacesPerChunk * 4 * 8 },
-      { id: 'indices', type: Uint32Array, size: maxFacesPerChunk * 6 },
+      // The planes of the sparse storage live in the pool (see growStore)
+      ...(isSparse ? [
+        { id: 'bricks', type: Int32Array, size: bricks },
+        { id: 'store', type: Int32Array, size: 7 },
+      ] : [
+        { id: 'planes', type: Uint8Array, size: this.cells * 6 },
+      ]),
+      { id: 'colliderBoxes', type: Uint8Array, size: maxVoxelsPerRegion * 6 },
+      { id: 'colliderHash', type: Uint32Array, size: 1 },
+      { id: 'colliderRows', type: Uint8Array, size: colliderSize * colliderSize * Math.ceil(colliderSize / 64) * 8 },
+      { id: 'raycastHit', type: Int32Array, size: 6 },
+      { id: 'sweepPosition', type: Float32Array, size: 3 },
+      { id: 'obstaclesMap', type: Uint8Array, size: Math.ceil(volume / 8) },
+      { id: 'vertices', type: Uint8Array, size: this.meshCapacity * 4 * 8 },
+      { id: 'meshList', type: Int32Array, size: chunks * 4 },
+      { id: 'meshBounds', type: Float32Array, size: chunks * 4 },
+      { id: 'meshFaces', type: Int32Array, size: chunks * 2 },
+      { id: 'meshDirections', type: Int32Array, size: chunks * 6 },
+      { id: 'meshConnections', type: Int32Array, size: chunks },
+      {
+        id: 'neighbors',
+        type: Uint8Array,
+        size: ((chunkSize + 2) ** 2) * Math.ceil((chunkSize + 2) / 64) * 8 + ((chunkSize + 2) ** 3) * 3
+          + ((chunkSize + 2) ** 2) * Math.ceil((chunkSize + 2) / 64) * 16 + ((chunkSize + 2) ** 2) * 4
+          + ((chunkSize + 1) ** 2) * 48 + (chunkSize + 1) * Math.ceil((chunkSize + 1) / 64) * 96,
+      },
+      // Slices of the saved & networked voxels (a layer of bricks at a time in the bricked layout)
+      { id: 'transcodeSlab', type: Uint8Array, size: width * height * (this.brickSize || 1) * 6 },
       { id: 'heightmap', type: Int32Array, size: width * depth },
       { id: 'queueA', type: Int32Array, size: queueSize },
       { id: 'queueB', type: Int32Array, size: queueSize },
-      { id: 'queueC', type: Int32Array, size: queueSize },
-      { id: 'world', type: Int32Array, size: 4 },
-      { id: 'bounds', type: Float32Array, size: 4 },
+      { id: 'lightPending', type: Uint8Array, size: Math.ceil(volume / 8) },
+      { id: 'lightPendingSeeds', type: Uint8Array, size: Math.ceil(volume / 8) },
+      { id: 'lightQueues', type: Int32Array, size: 7 },
+      { id: 'dirtyChunks', type: Uint8Array, size: chunks },
+      { id: 'dirtyList', type: Int32Array, size: chunks },
+      { id: 'dirty', type: Int32Array, size: 5 },
+      { id: 'voxels', type: Int32Array, size: 3 },
+      { id: 'world', type: Int32Array, size: 7 },
     ];
     const pages = Math.ceil(layout.reduce((total, { type, size }) => (
       total + size * type.BYTES_PER_ELEMENT
     ), 0) / 65536) + 10;
-    const memory = new WebAssembly.Memory({ initial: pages, maximum: pages });
+    // The pool of the sparse storage grows the memory
+    const memory = new WebAssembly.Memory({ initial: pages, ...(isSparse ? {} : { maximum: pages }) });
+    this.memory = memory;
+    this.layout = layout;
     VoxelWorld.getWASM()
       .then((wasm) => WebAssembly.instantiate(wasm, { env: { memory } }))
       .then((instance) => {
+        const missing = VoxelWorld.wasmExports.filter((name) => (
+          typeof instance.exports[name] !== 'function'
+        ));
+        if (missing.length) {
+          throw new Error(`voxels.wasm is outdated (missing: ${missing.join(', ')}). Rebuild it with: npm run compile`);
+        }
+        this._malloc = instance.exports.malloc;
+        this._realloc = instance.exports.realloc;
+        this._brush = instance.exports.brush;
+        this._clear = instance.exports.clear;
         this._colliders = instance.exports.colliders;
+        this._compact = instance.exports.compact;
         this._findGround = instance.exports.findGround;
         this._findPath = instance.exports.findPath;
         this._findTarget = instance.exports.findTarget;
@@ -51,45 +133,160 @@ class VoxelWorld {
         this._getHeight = instance.exports.getHeight;
         this._getLight = instance.exports.getLight;
         this._heightmap = instance.exports.heightmap;
-        this._mesh = instance.exports.mesh;
+        this._meshChunks = instance.exports.meshChunks;
         this._propagate = instance.exports.propagate;
+        this._raycast = instance.exports.raycast;
+        this._relight = instance.exports.relight;
+        this._sweep = instance.exports.sweep;
+        this._transcode = instance.exports.transcode;
+        this._unshare = instance.exports.unshare;
         this._update = instance.exports.update;
-        layout.forEach(({ id, type, size }) => {
-          const address = instance.exports.malloc(size * type.BYTES_PER_ELEMENT);
-          this[id] = {
-            address,
-            view: new type(memory.buffer, address, size),
-          };
+        layout.forEach((buffer) => {
+          buffer.address = instance.exports.malloc(buffer.size * buffer.type.BYTES_PER_ELEMENT);
         });
-        this.world.view.set([width, height, depth, seaLevel]);
+        this.updateViews();
+        if (isSparse) {
+          this.store.view.set([this.bricks.address, 0, 0, 0]);
+          this.growStore(capacity);
+        } else {
+          this.setPlanes();
+        }
+        // Light propagation reuses queueA & queueB
+        this.lightQueues.view.set([
+          this.queueA.address,
+          this.queueB.address,
+          this.lightPending.address,
+          this.lightPendingSeeds.address,
+          queueSize,
+        ]);
+        // Downsampled meshes read up to a whole cell (2x or 4x voxels) around their chunk
+        this.dirty.view.set([
+          this.dirtyChunks.address,
+          this.dirtyList.address,
+          chunkSize,
+          1 << Math.min(lodDistances.length, 2),
+        ]);
+        this.world.view.set([
+          width,
+          height,
+          depth,
+          seaLevel,
+          this.brickSize,
+          isSparse ? this.store.address : 0,
+          this.dirty.address,
+        ]);
+        if (isSparse) {
+          // Every brick starts pointing to the empty slot
+          this._clear(this.world.address, this.voxels.address);
+        }
         onLoad();
       })
       .catch((e) => console.error(e));
   }
 
+  // (Re)creates the views of the buffers, since growing the memory detaches the previous ones.
+  // The buffers keep their object, so the methods can hold onto them while the pool grows.
+  updateViews() {
+    const { layout, memory, pool } = this;
+    layout.forEach(({
+      id,
+      type,
+      size,
+      address,
+    }) => {
+      if (!this[id]) {
+        this[id] = { address };
+      }
+      this[id].view = new type(memory.buffer, address, size);
+    });
+    if (pool) {
+      if (!this.planes) {
+        this.planes = {};
+      }
+      this.planes.address = pool.address;
+      this.planes.view = new Uint8Array(memory.buffer, pool.address, this.cells * 6);
+    }
+  }
+
+  // Types, colors & light planes
+  setPlanes() {
+    const { cells, planes, voxels } = this;
+    voxels.view.set([
+      planes.address,
+      planes.address + cells,
+      planes.address + cells * 4,
+    ]);
+  }
+
+  // Moves the slots of the sparse storage into a bigger pool:
+  // types (cells), colors (cells * 3), light (cells * 2), references & compact scratch (capacity ints)
+  growStore(capacity) {
+    const { brickSize, pool } = this;
+    const cells = brickSize ** 3;
+    const previous = pool ? pool.capacity : 0;
+    const size = capacity * (cells * 6 + 8);
+    const address = pool ? this._realloc(pool.address, size) : this._malloc(size);
+    if (!address) {
+      throw new Error('Ran out of memory for the bricks');
+    }
+    const memory = new Uint8Array(this.memory.buffer);
+    const from = previous * cells;
+    const to = capacity * cells;
+    // From the last plane to the first one, since they only move forwards
+    memory.copyWithin(address + to * 6, address + from * 6, address + from * 6 + previous * 4);
+    memory.fill(0, address + to * 6 + previous * 4, address + size);
+    memory.copyWithin(address + to * 4, address + from * 4, address + from * 6);
+    memory.copyWithin(address + to, address + from, address + from * 4);
+    this.pool = { address, capacity };
+    this.cells = to;
+    this.updateViews();
+    this.setPlanes();
+    this.store.view.set([address + to * 6, address + to * 6 + capacity * 4, capacity], 1);
+  }
+
+  // Grows the pool of the sparse storage when it ran out of slots.
+  // Returns false if it can't grow any further (it already has maxBricks slots).
+  expandStore() {
+    const { maxBricks, pool } = this;
+    if (pool.capacity >= maxBricks) {
+      return false;
+    }
+    this.growStore(Math.min(Math.ceil(pool.capacity * 1.5), maxBricks));
+    return true;
+  }
+
+  // Boxes (x, y, z, width, height, depth) that cover the solid voxels of a region
+  // (colliderRegion chunks per side) and a hash of them (the same boxes always get the same hash).
+  // The regions on the edges can overhang the world, that part of them is air.
   colliders(x, y, z) {
     const {
       world,
       voxels,
       colliderBoxes,
-      colliderMap,
+      colliderHash,
+      colliderRows,
       chunkSize,
+      colliderRegion,
     } = this;
-    colliderMap.view.fill(0);
+    const size = chunkSize * colliderRegion;
     const boxes = this._colliders(
       world.address,
       voxels.address,
       colliderBoxes.address,
-      colliderMap.address,
-      chunkSize,
-      x * chunkSize,
-      y * chunkSize,
-      z * chunkSize
+      colliderHash.address,
+      colliderRows.address,
+      size,
+      x * size,
+      y * size,
+      z * size
     );
     if (boxes === -1) {
-      throw new Error('Requested chunk is out of bounds');
+      throw new Error('Requested region is out of bounds');
     }
-    return colliderBoxes.view.subarray(0, boxes * 6);
+    return {
+      boxes: colliderBoxes.view.subarray(0, boxes * 6),
+      hash: colliderHash.view[0],
+    };
   }
 
   findGround({
@@ -143,6 +340,10 @@ class VoxelWorld {
     if (nodes === -1) {
       throw new Error('Requested path is out of bounds');
     }
+    // A* allocates its nodes in the wasm memory, which can grow it with the sparse storage
+    if (queueA.view.buffer !== this.memory.buffer) {
+      this.updateViews();
+    }
     return queueA.view.subarray(0, nodes * 4);
   }
 
@@ -185,51 +386,86 @@ class VoxelWorld {
       voxels,
       queueA,
       queueB,
-      queueC,
+      lightQueues,
       generator,
       seed,
     } = this;
-    heightmap.view.fill(0);
-    voxels.view.fill(0);
-    if (typeof generator === 'function') {
-      const { width, height, depth } = this;
-      for (let z = 0, voxel = 0; z < depth; z += 1) {
-        for (let y = 0; y < height; y += 1) {
-          for (let x = 0; x < width; x += 1, voxel += 6) {
-            const result = generator(x, y, z);
-            if (!result) {
-              continue;
-            }
-            voxels.view[voxel] = typeof result.type === 'number' ? result.type : VoxelWorld.blockTypes[result.type];
-            voxels.view[voxel + 1] = result.r;
-            voxels.view[voxel + 2] = result.g;
-            voxels.view[voxel + 3] = result.b;
-            const heightmapIndex = z * width + x;
-            if (heightmap.view[heightmapIndex] < y) {
-              heightmap.view[heightmapIndex] = y;
+    // Starts over with a bigger pool when the sparse storage runs out of slots
+    do {
+      heightmap.view.fill(0);
+      this._clear(world.address, voxels.address);
+      if (typeof generator === 'function') {
+        const {
+          width,
+          height,
+          depth,
+        } = this;
+        for (let z = 0; z < depth; z += 1) {
+          for (let y = 0; y < height; y += 1) {
+            for (let x = 0; x < width; x += 1) {
+              const result = generator(x, y, z);
+              if (!result) {
+                continue;
+              }
+              // unshare can grow the pool (moving the planes)
+              const voxel = this.unshare(x, y, z);
+              const { cells, planes } = this;
+              planes.view[voxel] = typeof result.type === 'number' ? result.type : VoxelWorld.blockTypes[result.type];
+              planes.view[cells + voxel * 3] = result.r;
+              planes.view[cells + voxel * 3 + 1] = result.g;
+              planes.view[cells + voxel * 3 + 2] = result.b;
+              const heightmapIndex = z * width + x;
+              if (heightmap.view[heightmapIndex] < y) {
+                heightmap.view[heightmapIndex] = y;
+              }
             }
           }
         }
+      } else {
+        this._generate(
+          world.address,
+          heightmap.address,
+          voxels.address,
+          queueA.address,
+          queueB.address,
+          generator,
+          seed
+        );
       }
-    } else {
-      this._generate(
+      this._propagate(
         world.address,
         heightmap.address,
         voxels.address,
-        queueA.address,
-        queueB.address,
-        generator,
-        seed
+        lightQueues.address
       );
+    } while (this.hasOverflown() && this.expandStore());
+    this.compact();
+  }
+
+  // Shares the uniform bricks of the sparse storage.
+  // (It also gets compacted whenever it runs out of slots)
+  compact() {
+    const { world, voxels, store } = this;
+    if (!store) {
+      return;
+    }
+    this._compact(world.address, voxels.address);
+  }
+
+  // Returns (and resets) whether any write got dropped because the sparse storage ran out of slots
+  hasOverflown() {
+    const { store } = this;
+    if (!store || store.view[5] === 0) {
+      return false;
+    }
+    store.view[5] = 0;
+    return true;
+  }
+
+  checkStore() {
+    if (this.hasOverflown()) {
+      throw new Error('Ran out of bricks. Increase maxBricks');
     }
-    this._propagate(
-      world.address,
-      heightmap.address,
-      voxels.address,
-      queueA.address,
-      queueB.address,
-      queueC.address
-    );
   }
 
   getHeight(x, z) {
@@ -256,36 +492,305 @@ class VoxelWorld {
     );
   }
 
-  mesh(x, y, z) {
+  getVoxel(x, y, z) {
+    const {
+      brickSize,
+      width,
+      height,
+      bricks,
+    } = this;
+    if (brickSize) {
+      // Same as getVoxel in voxels.c
+      const bricksX = width / brickSize;
+      const bricksY = height / brickSize;
+      const brick = (
+        (Math.floor(z / brickSize) * bricksY + Math.floor(y / brickSize)) * bricksX + Math.floor(x / brickSize)
+      );
+      const slot = bricks ? bricks.view[brick] : brick;
+      return (
+        slot * brickSize * brickSize * brickSize
+        + ((z % brickSize) * brickSize + (y % brickSize)) * brickSize + (x % brickSize)
+      );
+    }
+    return z * width * height + y * width + x;
+  }
+
+  // Returns the voxel in a slot that can be written.
+  // (In the sparse storage, this copies the brick when it's shared with other ones)
+  unshare(x, y, z) {
+    const { world, voxels, store } = this;
+    if (!store) {
+      return this.getVoxel(x, y, z);
+    }
+    let voxel = this._unshare(world.address, voxels.address, x, y, z);
+    while (voxel === -1 && this.hasOverflown() && this.expandStore()) {
+      voxel = this._unshare(world.address, voxels.address, x, y, z);
+    }
+    this.checkStore();
+    return voxel;
+  }
+
+  mesh(x, y, z, lod = 0) {
+    return this.meshChunks([{ x, y, z, lod }])[0];
+  }
+
+  // Meshes a list of chunks (default: all of them, in z, y, x order) in as few calls as possible.
+  // lod: 0 (full), 1 (2x) or 2 (4x downsampled)
+  // The geometries of every call are views over a single copy of its output.
+  // Their faces are grouped by direction: top, bottom, south, north, east & west (see directions).
+  // connections has a bit (a * 6 + b) for every pair of sides (a < b, in that same order)
+  // that can see each other through the air inside the chunk.
+  meshChunks(chunks) {
     const {
       world,
       voxels,
+      width,
+      height,
+      depth,
       chunkSize,
-      bounds,
-      indices,
       vertices,
+      neighbors,
+      meshList,
+      meshBounds,
+      meshFaces,
+      meshDirections,
+      meshConnections,
+      meshCapacity,
+      greedyMeshing,
+    } = this;
+    if (!chunks) {
+      chunks = [];
+      for (let z = 0; z < depth / chunkSize; z += 1) {
+        for (let y = 0; y < height / chunkSize; y += 1) {
+          for (let x = 0; x < width / chunkSize; x += 1) {
+            chunks.push({ x, y, z, lod: 0 });
+          }
+        }
+      }
+    }
+    const geometries = [];
+    chunks.forEach(({ x, y, z, lod = 0 }, i) => {
+      meshList.view.set([x * chunkSize, y * chunkSize, z * chunkSize, lod], i * 4);
+    });
+    while (geometries.length < chunks.length) {
+      const offset = geometries.length;
+      const count = this._meshChunks(
+        world.address,
+        voxels.address,
+        meshBounds.address,
+        meshFaces.address,
+        meshDirections.address,
+        meshConnections.address,
+        vertices.address,
+        neighbors.address,
+        meshList.address + offset * 4 * Int32Array.BYTES_PER_ELEMENT,
+        chunks.length - offset,
+        meshCapacity,
+        chunkSize,
+        greedyMeshing
+      );
+      let faces = 0;
+      for (let i = 0; i < count; i += 1) {
+        if (meshFaces.view[i * 2 + 1] === -1) {
+          throw new Error('Requested chunk is out of bounds');
+        }
+        faces = meshFaces.view[i * 2] + meshFaces.view[i * 2 + 1];
+      }
+      const batch = {
+        bounds: meshBounds.view.slice(0, count * 4),
+        directions: meshDirections.view.slice(0, count * 6),
+        connections: meshConnections.view.slice(0, count),
+        vertices: vertices.view.slice(0, faces * 4 * 8),
+      };
+      for (let i = 0; i < count; i += 1) {
+        const first = meshFaces.view[i * 2];
+        const last = first + meshFaces.view[i * 2 + 1];
+        geometries.push({
+          bounds: batch.bounds.subarray(i * 4, (i + 1) * 4),
+          directions: batch.directions.subarray(i * 6, (i + 1) * 6),
+          connections: batch.connections[i],
+          vertices: batch.vertices.subarray(first * 4 * 8, last * 4 * 8),
+        });
+      }
+    }
+    return geometries;
+  }
+
+  // Walks the voxels along a ray (in world space, with a normalized direction)
+  // without going through the physics colliders, so it doesn't need them to be up to date.
+  // Returns the first solid voxel, the normal of the face it hit & the point and distance to it.
+  raycast(origin, direction, far = 64) {
+    const {
+      world,
+      voxels,
+      raycastHit,
+      scale,
     } = this;
-    const faces = this._mesh(
+    const distance = this._raycast(
+      world.address,
+      voxels.address,
+      raycastHit.address,
+      origin.x / scale,
+      origin.y / scale,
+      origin.z / scale,
+      direction.x,
+      direction.y,
+      direction.z,
+      far / scale
+    );
+    if (distance === -1) {
+      return false;
+    }
+    const [x, y, z, nx, ny, nz] = raycastHit.view;
+    return {
+      distance: distance * scale,
+      normal: { x: nx, y: ny, z: nz },
+      point: {
+        x: origin.x + direction.x * distance * scale,
+        y: origin.y + direction.y * distance * scale,
+        z: origin.z + direction.z * distance * scale,
+      },
+      voxel: { x, y, z },
+    };
+  }
+
+  // Recomputes the light of the vertices of a chunk mesh (with the same lod) into light
+  // (light & sunlight of every vertex). It only reads the positions of the vertices.
+  // Returns false if it can't (merged faces): the chunk needs to be remeshed instead.
+  relight(x, y, z, lod, geometry, light) {
+    const {
+      world,
+      voxels,
+      chunkSize,
+      vertices,
+      neighbors,
+    } = this;
+    const faces = geometry.length / (4 * 8);
+    // The light goes right after the vertices
+    // (the arena has room for two worst cases of a chunk)
+    vertices.view.set(geometry);
+    if (this._relight(
       world.address,
       voxels.address,
-      bounds.address,
-      indices.address,
       vertices.address,
+      vertices.address + geometry.length,
+      neighbors.address,
+      faces,
       chunkSize,
+      lod,
       x * chunkSize,
       y * chunkSize,
       z * chunkSize
+    ) === -1) {
+      return false;
+    }
+    light.set(vertices.view.subarray(geometry.length, geometry.length + light.length));
+    return true;
+  }
+
+  // Moves a box (in world space) against the voxels, sliding along the ones that block it
+  // & stepping up onto ledges up to step tall, so it doesn't need any physics bodies.
+  // position is the center of the bottom of the box and gets updated with where it ends up.
+  // Returns the VoxelWorld.sweepContacts of the move.
+  sweep({
+    position,
+    radius,
+    height,
+    step = 0,
+    move,
+  }) {
+    const {
+      world,
+      voxels,
+      sweepPosition,
+      scale,
+    } = this;
+    sweepPosition.view[0] = position.x / scale;
+    sweepPosition.view[1] = position.y / scale;
+    sweepPosition.view[2] = position.z / scale;
+    const contacts = this._sweep(
+      world.address,
+      voxels.address,
+      sweepPosition.address,
+      radius / scale,
+      height / scale,
+      step / scale,
+      move.x / scale,
+      move.y / scale,
+      move.z / scale
     );
-    if (faces === -1) {
-      throw new Error('Requested chunk is out of bounds');
+    position.x = sweepPosition.view[0] * scale;
+    position.y = sweepPosition.view[1] * scale;
+    position.z = sweepPosition.view[2] * scale;
+    return contacts;
+  }
+
+  brush({
+    shape,
+    size,
+    type,
+    x, y, z,
+    r, g, b,
+    noise,
+    seed = VoxelWorld.brushSeed(),
+  }) {
+    const {
+      world,
+      heightmap,
+      voxels,
+      lightQueues,
+    } = this;
+    // It doesn't write anything when the sparse storage doesn't have enough slots for it
+    while (this._brush(
+      world.address,
+      heightmap.address,
+      voxels.address,
+      lightQueues.address,
+      shape,
+      size,
+      type,
+      x, y, z,
+      r, g, b,
+      noise,
+      seed
+    ) === -1) {
+      if (!this.expandStore()) {
+        throw new Error('Ran out of bricks. Increase maxBricks');
+      }
     }
-    return {
-      bounds: new Float32Array(bounds.view),
-      indices: new ((faces * 4 - 1) <= 65535 ? Uint16Array : Uint32Array)(
-        indices.view.subarray(0, faces * 6)
-      ),
-      vertices: new Uint8Array(vertices.view.subarray(0, faces * 4 * 8)),
-    };
+  }
+
+  // Returns (and resets) the chunks changed by brush & update since the last call
+  // mesh: The chunk mesh needs to be updated
+  // colliders: The chunk colliders need to be updated
+  // light: Only the light of the chunk mesh needs to be updated (see relight)
+  getDirtyChunks() {
+    const {
+      chunkSize,
+      width,
+      height,
+      dirty,
+      dirtyChunks,
+      dirtyList,
+    } = this;
+    const chunksX = width / chunkSize;
+    const chunksY = height / chunkSize;
+    const chunks = [];
+    for (let i = 0, l = dirty.view[4]; i < l; i += 1) {
+      const chunk = dirtyList.view[i];
+      const flags = dirtyChunks.view[chunk];
+      dirtyChunks.view[chunk] = 0;
+      chunks.push({
+        x: chunk % chunksX,
+        y: Math.floor(chunk / chunksX) % chunksY,
+        z: Math.floor(chunk / (chunksX * chunksY)),
+        mesh: (flags & VoxelWorld.chunkFlags.mesh) !== 0,
+        colliders: (flags & VoxelWorld.chunkFlags.colliders) !== 0,
+        light: (flags & VoxelWorld.chunkFlags.light) !== 0,
+      });
+    }
+    dirty.view[4] = 0;
+    return chunks;
   }
 
   update({
@@ -297,77 +802,95 @@ class VoxelWorld {
       world,
       heightmap,
       voxels,
-      queueA,
-      queueB,
-      queueC,
+      lightQueues,
     } = this;
-    this._update(
+    // It doesn't write anything when the sparse storage doesn't have enough slots for it
+    while (this._update(
       world.address,
       heightmap.address,
       voxels.address,
-      queueA.address,
-      queueB.address,
-      queueC.address,
+      lightQueues.address,
       type,
       x, y, z,
       r, g, b
-    );
+    ) === -1) {
+      if (!this.expandStore()) {
+        throw new Error('Ran out of bricks. Increase maxBricks');
+      }
+    }
   }
 
   load(deflated) {
     if (!VoxelWorld.zlib) VoxelWorld.setupZlibWorker();
     const { zlib } = VoxelWorld;
-    const {
-      world,
-      heightmap,
-      voxels,
-    } = this;
     return zlib.request({ data: deflated, operation: 'unzlib' })
-      .then((buffer) => {
-        voxels.view.set(buffer);
-        this._heightmap(
-          world.address,
-          heightmap.address,
-          voxels.address
-        );
-      });
+      .then((buffer) => this.deserialize(buffer));
   }
 
   save() {
     if (!VoxelWorld.zlib) VoxelWorld.setupZlibWorker();
     const { zlib } = VoxelWorld;
-    const { voxels } = this;
-    return zlib.request({ data: new Uint8Array(voxels.view), operation: 'zlib' });
+    return zlib.request({ data: this.serialize(), operation: 'zlib' });
   }
 
-  static getBrush({ shape, size }) {
-    const { brushShapes, brushes } = VoxelWorld;
-    const key = `${shape}:${size}`;
-    let brush = brushes.get(key);
-    if (!brush) {
-      brush = [];
-      if (shape === brushShapes.box) {
-        size -= 1;
+  // Saved and networked voxels are always in the linear layout,
+  // with the fields interleaved: type, r, g, b, light, sunlight.
+  serialize() {
+    const {
+      width,
+      height,
+      depth,
+      brickSize,
+      world,
+      voxels,
+      transcodeSlab,
+    } = this;
+    const linear = new Uint8Array(width * height * depth * 6);
+    const slices = brickSize || 1;
+    for (let z = 0; z < depth; z += slices) {
+      this._transcode(world.address, voxels.address, transcodeSlab.address, true, z, z + slices);
+      linear.set(transcodeSlab.view, z * width * height * 6);
+    }
+    return linear;
+  }
+
+  deserialize(buffer) {
+    const {
+      width,
+      height,
+      depth,
+      brickSize,
+      world,
+      heightmap,
+      voxels,
+      store,
+      transcodeSlab,
+    } = this;
+    const slices = brickSize || 1;
+    const slab = width * height * slices * 6;
+    // Starts over with a bigger pool when the sparse storage runs out of slots
+    let z = 0;
+    while (z < depth) {
+      if (z === 0 && store) {
+        this._clear(world.address, voxels.address);
       }
-      const radius = Math.sqrt(((size * 0.5) ** 2) * 3);
-      for (let z = -size; z <= size; z += 1) {
-        for (let y = -size; y <= size; y += 1) {
-          for (let x = -size; x <= size; x += 1) {
-            if (
-              shape === brushShapes.box
-              || Math.sqrt(x ** 2 + y ** 2 + z ** 2) <= radius
-            ) {
-              brush.push({ x, y, z });
-            }
-          }
+      transcodeSlab.view.set(buffer.subarray(z * width * height * 6, z * width * height * 6 + slab));
+      if (this._transcode(world.address, voxels.address, transcodeSlab.address, false, z, z + slices) === -1) {
+        this.hasOverflown();
+        if (!this.expandStore()) {
+          throw new Error('Ran out of bricks. Increase maxBricks');
         }
+        z = 0;
+        continue;
       }
-      brush.sort((a, b) => (
-        Math.sqrt(a.x ** 2 + a.y ** 2 + a.z ** 2) - Math.sqrt(b.x ** 2 + b.y ** 2 + b.z ** 2)
-      ));
-      brushes.set(key, brush);
+      z += slices;
     }
-    return brush;
+    this.compact();
+    this._heightmap(
+      world.address,
+      heightmap.address,
+      voxels.address
+    );
   }
 
   static getWASM() {
@@ -425,13 +948,59 @@ VoxelWorld.blockTypes = {
   tree: 4,
 };
 
-VoxelWorld.brushes = new Map();
+VoxelWorld.chunkFlags = {
+  mesh: 1,
+  colliders: 2,
+  light: 4,
+};
+
+VoxelWorld.sweepContacts = {
+  wall: 1,
+  ground: 2,
+  ceiling: 4,
+  step: 8,
+};
+
+// Functions used from voxels.wasm (they must match the exports in core/voxels/compile.sh)
+VoxelWorld.wasmExports = [
+  'malloc',
+  'realloc',
+  'brush',
+  'clear',
+  'colliders',
+  'compact',
+  'findGround',
+  'findPath',
+  'findTarget',
+  'generate',
+  'getHeight',
+  'getLight',
+  'heightmap',
+  'meshChunks',
+  'propagate',
+  'raycast',
+  'relight',
+  'sweep',
+  'transcode',
+  'unshare',
+  'update',
+];
+
+// Peers must brush with the same seed to get the same color noise
+// (It's never 0, as that's what an UPDATE without a seed decodes to)
+VoxelWorld.brushSeed = () => 1 + Math.floor(Math.random() * 0x7FFFFFFE);
 
 VoxelWorld.brushShapes = {
   box: 0,
   sphere: 1,
 };
 
+VoxelWorld.storages = {
+  linear: 0,
+  bricked: 1,
+  sparse: 2,
+};
+
 VoxelWorld.generators = {
   blank: 0,
   default: 1,
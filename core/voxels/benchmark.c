@@ -0,0 +1,945 @@
+// Reproducible benchmark of the voxel engine hot paths.
+//
+// Generates fixed-seed worlds with each built-in generator at several sizes
+// and times generate, propagate, mesh/colliders (per chunk), brush updates, relight (vs remeshing),
+// findPath, findTarget, raycast and sweep. Every measurement is printed to stdout as a JSON line
+// (including a checksum of the produced output, so regressions in the results
+// are caught along the regressions in the timings).
+// Built with -DVOXELS_COUNTERS=ON, the mesh operations also report the face corners
+// that got their lighting computed and the neighborhood reads for it, per face.
+//
+// Usage: voxels_benchmark [--repeat N] [--size small|medium|large] [--generator name] [--storage linear|bricked|sparse]
+//   (--size, --generator and --storage can be used multiple times)
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "voxels.h"
+
+typedef struct {
+  const char* name;
+  const unsigned char generator;
+} BenchmarkGenerator;
+
+static const BenchmarkGenerator generators[] = {
+  { "default", GENERATOR_DEFAULT },
+  { "debugCity", GENERATOR_DEBUG_CITY },
+  { "partyBuildings", GENERATOR_PARTY_BUILDINGS },
+  { "pit", GENERATOR_PIT },
+  { "sculpt", GENERATOR_SCULPT },
+};
+
+typedef struct {
+  const char* name;
+  const int width;
+  const int height;
+  const int depth;
+} BenchmarkSize;
+
+static const BenchmarkSize sizes[] = {
+  { "small", 128, 64, 128 },
+  { "medium", 256, 96, 256 },
+  { "large", 384, 128, 384 },
+};
+
+typedef struct {
+  const char* name;
+  const int brickSize;
+  const bool sparse;
+} BenchmarkStorage;
+
+static const BenchmarkStorage storages[] = {
+  { "linear", 0, false },
+  { "bricked", 16, false },
+  { "sparse", 16, true },
+};
+
+typedef struct {
+  const char* generator;
+  const BenchmarkSize* size;
+  const char* storage;
+} BenchmarkCase;
+
+static const int seed = 987654321;
+static const int seaLevel = 6;
+static const unsigned char chunkSize = 16;
+static const int brushSize = 4;
+static const int brushes = 16;
+static const int paths = 64;
+static const int agentHeight = 4;
+static const int searchRadius = 64;
+static const int rays = 4096;
+static const float rayDistance = 128;
+static const int walkers = 64;
+static const int walkerSteps = 256;
+
+typedef struct {
+  World world;
+  int* heightmap;
+  VoxelStore* store;
+  unsigned char* planes;
+  Voxels voxels;
+  unsigned char* obstacles;
+  int* queueA;
+  int* queueB;
+  LightQueues* lightQueues;
+  DirtyChunks* dirty;
+  size_t chunks;
+  unsigned char* colliderBoxes;
+  unsigned long long* colliderRows;
+  unsigned char* neighbors;
+  float* bounds;
+  int* directions;
+  int* connections;
+  unsigned char* vertices;
+  int meshCapacity;
+  int* meshList;
+  float* meshBounds;
+  int* meshFaces;
+  int* meshDirections;
+  int* meshConnections;
+  size_t voxelsSize;
+  size_t heightmapSize;
+  size_t bricksSize;
+} Buffers;
+
+typedef struct {
+  unsigned char* planes;
+  int* bricks;
+  int* references;
+  int used;
+  int next;
+} Snapshot;
+
+typedef struct {
+  int x;
+  int y;
+  int z;
+} Offset;
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static unsigned int checksum(unsigned int hash, const void* data, const size_t size) {
+  // FNV-1a
+  const unsigned char* bytes = data;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static void* allocate(const size_t size) {
+  void* buffer = calloc(size, 1);
+  if (buffer == NULL) {
+    fprintf(stderr, "Failed to allocate %zu bytes\n", size);
+    exit(1);
+  }
+  return buffer;
+}
+
+static Buffers createBuffers(const BenchmarkSize* size, const BenchmarkStorage* storage) {
+  // Same layout as core/voxels.js
+  const int maxVoxelsPerChunk = ceil(chunkSize * chunkSize * chunkSize * 0.5);
+  const int maxFacesPerChunk = maxVoxelsPerChunk * 6;
+  const int meshCapacity = maxFacesPerChunk * 2;
+  const size_t volume = (size_t) size->width * size->height * size->depth;
+  const size_t queueSize = (size_t) size->width * size->depth * 3;
+  const size_t bricks = storage->sparse ? volume / (storage->brickSize * storage->brickSize * storage->brickSize) : 0;
+  VoxelStore* store = NULL;
+  // Track the changed chunks, like core/voxels.js does
+  const size_t chunks = (size_t) (size->width / chunkSize) * (size->height / chunkSize) * (size->depth / chunkSize);
+  DirtyChunks* dirty = allocate(sizeof(DirtyChunks));
+  {
+    const DirtyChunks init = { allocate(chunks), allocate(chunks * sizeof(int)), chunkSize, 1 };
+    memcpy(dirty, &init, sizeof(DirtyChunks));
+  }
+  if (storage->sparse) {
+    // Enough slots for every brick, so it never overflows
+    const VoxelStore init = { allocate(bricks * sizeof(int)), allocate(bricks * sizeof(int)), allocate(bricks * sizeof(int)), bricks };
+    store = allocate(sizeof(VoxelStore));
+    memcpy(store, &init, sizeof(VoxelStore));
+  }
+  const size_t voxelsSize = volume * (1 + COLORS_STRIDE + LIGHT_STRIDE);
+  unsigned char* planes = allocate(voxelsSize);
+  Buffers buffers = {
+    .world = { size->width, size->height, size->depth, seaLevel, storage->brickSize, store, dirty },
+    .store = store,
+    .dirty = dirty,
+    .chunks = chunks,
+    .planes = planes,
+    .voxels = { planes, planes + volume, planes + volume * (1 + COLORS_STRIDE) },
+    .voxelsSize = voxelsSize,
+    .heightmapSize = (size_t) size->width * size->depth * sizeof(int),
+    .bricksSize = bricks * sizeof(int),
+  };
+  buffers.heightmap = allocate(buffers.heightmapSize);
+  buffers.obstacles = allocate((volume + 7) / 8);
+  buffers.queueA = allocate(queueSize * sizeof(int));
+  buffers.queueB = allocate(queueSize * sizeof(int));
+  {
+    // Light propagation reuses queueA & queueB
+    const LightQueues init = {
+      buffers.queueA, buffers.queueB, allocate((volume + 7) / 8), allocate((volume + 7) / 8), queueSize,
+    };
+    buffers.lightQueues = allocate(sizeof(LightQueues));
+    memcpy(buffers.lightQueues, &init, sizeof(LightQueues));
+  }
+  buffers.colliderBoxes = allocate(maxVoxelsPerChunk * 6);
+  buffers.colliderRows = allocate(chunkSize * chunkSize * ((chunkSize + 63) / 64) * sizeof(unsigned long long));
+  buffers.neighbors = allocate(
+    (chunkSize + 2) * (chunkSize + 2) * ((chunkSize + 2 + 63) / 64) * 8
+    + (chunkSize + 2) * (chunkSize + 2) * (chunkSize + 2) * (1 + LIGHT_STRIDE)
+    + (chunkSize + 2) * (chunkSize + 2) * ((chunkSize + 2 + 63) / 64) * 16 + (chunkSize + 2) * (chunkSize + 2) * 4
+    + (chunkSize + 1) * (chunkSize + 1) * 48 + (chunkSize + 1) * ((chunkSize + 1 + 63) / 64) * 96
+  );
+  buffers.bounds = allocate(4 * sizeof(float));
+  buffers.directions = allocate(6 * sizeof(int));
+  buffers.connections = allocate(sizeof(int));
+  buffers.vertices = allocate(meshCapacity * 4 * 8);
+  buffers.meshCapacity = meshCapacity;
+  buffers.meshList = allocate(buffers.chunks * 4 * sizeof(int));
+  buffers.meshBounds = allocate(buffers.chunks * 4 * sizeof(float));
+  buffers.meshFaces = allocate(buffers.chunks * 2 * sizeof(int));
+  buffers.meshDirections = allocate(buffers.chunks * 6 * sizeof(int));
+  buffers.meshConnections = allocate(buffers.chunks * sizeof(int));
+  return buffers;
+}
+
+static void destroyBuffers(Buffers* buffers) {
+  if (buffers->store != NULL) {
+    free(buffers->store->bricks);
+    free(buffers->store->references);
+    free(buffers->store->scratch);
+    free(buffers->store);
+  }
+  free(buffers->dirty->chunks);
+  free(buffers->dirty->list);
+  free(buffers->dirty);
+  free(buffers->heightmap);
+  free(buffers->planes);
+  free(buffers->obstacles);
+  free(buffers->queueA);
+  free(buffers->queueB);
+  free(buffers->lightQueues->pending);
+  free(buffers->lightQueues->pendingSeeds);
+  free(buffers->lightQueues);
+  free(buffers->colliderBoxes);
+  free(buffers->colliderRows);
+  free(buffers->neighbors);
+  free(buffers->bounds);
+  free(buffers->directions);
+  free(buffers->connections);
+  free(buffers->vertices);
+  free(buffers->meshList);
+  free(buffers->meshBounds);
+  free(buffers->meshFaces);
+  free(buffers->meshDirections);
+  free(buffers->meshConnections);
+}
+
+static Snapshot createSnapshot(const Buffers* buffers) {
+  Snapshot snapshot = { allocate(buffers->voxelsSize) };
+  if (buffers->store != NULL) {
+    snapshot.bricks = allocate(buffers->bricksSize);
+    snapshot.references = allocate(buffers->bricksSize);
+  }
+  return snapshot;
+}
+
+static void destroySnapshot(Snapshot* snapshot) {
+  free(snapshot->planes);
+  free(snapshot->bricks);
+  free(snapshot->references);
+}
+
+static void saveSnapshot(Snapshot* snapshot, const Buffers* buffers) {
+  memcpy(snapshot->planes, buffers->planes, buffers->voxelsSize);
+  if (buffers->store != NULL) {
+    memcpy(snapshot->bricks, buffers->store->bricks, buffers->bricksSize);
+    memcpy(snapshot->references, buffers->store->references, buffers->bricksSize);
+    snapshot->used = buffers->store->used;
+    snapshot->next = buffers->store->next;
+  }
+}
+
+static void loadSnapshot(Buffers* buffers, const Snapshot* snapshot) {
+  memcpy(buffers->planes, snapshot->planes, buffers->voxelsSize);
+  if (buffers->store != NULL) {
+    memcpy(buffers->store->bricks, snapshot->bricks, buffers->bricksSize);
+    memcpy(buffers->store->references, snapshot->references, buffers->bricksSize);
+    buffers->store->used = snapshot->used;
+    buffers->store->next = snapshot->next;
+  }
+}
+
+static void beginReport(
+  const BenchmarkCase* test,
+  const char* operation,
+  const double ns,
+  const double voxels,
+  const char* unit,
+  const double count
+) {
+  printf(
+    "{\"generator\":\"%s\",\"size\":\"%dx%dx%d\",\"storage\":\"%s\",\"operation\":\"%s\",\"ns\":%.0f",
+    test->generator, test->size->width, test->size->height, test->size->depth, test->storage, operation, ns
+  );
+  if (voxels > 0) {
+    printf(",\"ns_per_voxel\":%.3f", ns / voxels);
+  }
+  if (unit != NULL) {
+    printf(",\"%s\":%.0f,\"%s_per_s\":%.0f", unit, count, unit, ns > 0 ? count / (ns * 1e-9) : 0);
+  }
+}
+
+static void endReport(const unsigned int hash) {
+  printf(",\"checksum\":\"%08x\"}\n", hash);
+  fflush(stdout);
+}
+
+static void report(
+  const BenchmarkCase* test,
+  const char* operation,
+  const double ns,
+  const double voxels,
+  const char* unit,
+  const double count,
+  const unsigned int hash
+) {
+  beginReport(test, operation, ns, voxels, unit, count);
+  endReport(hash);
+}
+
+static void storeMesh(Buffers* buffers, unsigned char** stored, int* faces, const int x, const int y, const int z) {
+  // Meshes a chunk (lod 0) into its own buffer
+  *faces = mesh(
+    &buffers->world, &buffers->voxels, buffers->bounds, buffers->directions, buffers->connections, buffers->vertices, buffers->neighbors,
+    chunkSize, false, 0, x * chunkSize, y * chunkSize, z * chunkSize
+  );
+  free(*stored);
+  *stored = NULL;
+  if (*faces > 0) {
+    *stored = allocate(*faces * 4 * 8);
+    memcpy(*stored, buffers->vertices, *faces * 4 * 8);
+  }
+}
+
+static unsigned int checksumVoxels(unsigned int hash, const Buffers* buffers) {
+  // Hashes the voxels in the linear order, so the checksums can be compared across storages
+  const World* world = &buffers->world;
+  for (int z = 0; z < world->depth; z++) {
+    for (int y = 0; y < world->height; y++) {
+      for (int x = 0; x < world->width; x++) {
+        int index = z * world->width * world->height + y * world->width + x;
+        if (world->brickSize) {
+          // Same as getVoxel in voxels.c
+          const int shift = __builtin_ctz(world->brickSize),
+                    mask = world->brickSize - 1,
+                    brick = (
+                      ((z >> shift) * (world->height >> shift) + (y >> shift)) * (world->width >> shift) + (x >> shift)
+                    ),
+                    slot = world->store ? world->store->bricks[brick] : brick;
+          index = (
+            (slot << (shift * 3))
+            | ((z & mask) << (shift * 2))
+            | ((y & mask) << shift)
+            | (x & mask)
+          );
+        }
+        // In the legacy interleaved order (type, r, g, b, light, sunlight)
+        hash = checksum(hash, buffers->voxels.types + index, 1);
+        hash = checksum(hash, buffers->voxels.colors + index * COLORS_STRIDE, COLORS_STRIDE);
+        hash = checksum(hash, buffers->voxels.light + index * LIGHT_STRIDE, LIGHT_STRIDE);
+      }
+    }
+  }
+  return hash;
+}
+
+static int compareOffsets(const void* a, const void* b) {
+  const Offset* oa = a;
+  const Offset* ob = b;
+  const int da = oa->x * oa->x + oa->y * oa->y + oa->z * oa->z;
+  const int db = ob->x * ob->x + ob->y * ob->y + ob->z * ob->z;
+  return da - db;
+}
+
+static int getSphereBrush(Offset* brush, const int size) {
+  // Same as VoxelWorld.getBrush({ shape: brushShapes.sphere, size })
+  const double radius = sqrt(((size * 0.5) * (size * 0.5)) * 3.0);
+  int count = 0;
+  for (int z = -size; z <= size; z++) {
+    for (int y = -size; y <= size; y++) {
+      for (int x = -size; x <= size; x++) {
+        if (sqrt(x * x + y * y + z * z) <= radius) {
+          brush[count++] = (Offset){ x, y, z };
+        }
+      }
+    }
+  }
+  qsort(brush, count, sizeof(Offset), compareOffsets);
+  return count;
+}
+
+static void benchmark(
+  const BenchmarkGenerator* generator,
+  const BenchmarkSize* size,
+  const BenchmarkStorage* storage,
+  const int repeat
+) {
+  const BenchmarkCase test = { generator->name, size, storage->name };
+  Buffers buffers = createBuffers(size, storage);
+  const World* world = &buffers.world;
+  const double volume = (double) size->width * size->height * size->depth;
+  Snapshot voxels = createSnapshot(&buffers);
+  int* heightmap = allocate(buffers.heightmapSize);
+
+  {
+    double best = INFINITY;
+    for (int i = 0; i < repeat; i++) {
+      memset(buffers.heightmap, 0, buffers.heightmapSize);
+      clear(world, &buffers.voxels);
+      const double start = now();
+      generate(world, buffers.heightmap, &buffers.voxels, buffers.queueA, buffers.queueB, generator->generator, seed);
+      const double elapsed = now() - start;
+      if (elapsed < best) best = elapsed;
+    }
+    report(
+      &test, "generate", best, volume, NULL, 0,
+      checksum(checksumVoxels(2166136261u, &buffers), buffers.heightmap, buffers.heightmapSize)
+    );
+    saveSnapshot(&voxels, &buffers);
+    memcpy(heightmap, buffers.heightmap, buffers.heightmapSize);
+  }
+
+  {
+    double best = INFINITY;
+    double nodes;
+    for (int i = 0; i < repeat; i++) {
+      loadSnapshot(&buffers, &voxels);
+      buffers.lightQueues->nodes = 0;
+      const double start = now();
+      propagate(world, buffers.heightmap, &buffers.voxels, buffers.lightQueues);
+      const double elapsed = now() - start;
+      if (elapsed < best) best = elapsed;
+      nodes = buffers.lightQueues->nodes;
+    }
+    report(
+      &test, "propagate", best, volume, "nodes", nodes,
+      checksumVoxels(2166136261u, &buffers)
+    );
+    if (buffers.store != NULL) {
+      // Slots in use after compacting the generated & lit world (out of one per brick)
+      const double start = now();
+      compact(world, &buffers.voxels);
+      const double elapsed = now() - start;
+      report(&test, "compact", elapsed, volume, "slots", buffers.store->used, checksumVoxels(2166136261u, &buffers));
+    }
+    saveSnapshot(&voxels, &buffers);
+  }
+
+  const int chunksX = size->width / chunkSize,
+            chunksY = size->height / chunkSize,
+            chunksZ = size->depth / chunkSize,
+            chunks = chunksX * chunksY * chunksZ;
+
+  static const struct {
+    const char* name;
+    const char* perChunk;
+    bool greedy;
+    unsigned char lod;
+  } meshModes[] = {
+    { "mesh", "mesh_per_chunk", false, 0 },
+    { "mesh_greedy", "mesh_greedy_per_chunk", true, 0 },
+    { "mesh_lod1", "mesh_lod1_per_chunk", false, 1 },
+    { "mesh_lod2", "mesh_lod2_per_chunk", false, 2 },
+  };
+  for (int mode = 0; mode < sizeof(meshModes) / sizeof(meshModes[0]); mode++) {
+    double best = INFINITY;
+    unsigned int hash;
+    double faces;
+    for (int i = 0; i < repeat; i++) {
+      hash = 2166136261u;
+      faces = 0;
+#ifdef VOXELS_COUNTERS
+      voxelsCounters = (VoxelsCounters){ 0 };
+#endif
+      double elapsed = 0;
+      for (int z = 0; z < chunksZ; z++) {
+        for (int y = 0; y < chunksY; y++) {
+          for (int x = 0; x < chunksX; x++) {
+            const double start = now();
+            const int count = mesh(
+              world, &buffers.voxels, buffers.bounds, buffers.directions, buffers.connections, buffers.vertices, buffers.neighbors,
+              chunkSize, meshModes[mode].greedy, meshModes[mode].lod, x * chunkSize, y * chunkSize, z * chunkSize
+            );
+            elapsed += now() - start;
+            faces += count;
+            hash = checksum(hash, buffers.vertices, count * 4 * 8);
+            if (count > 0) {
+              hash = checksum(hash, buffers.bounds, 4 * sizeof(float));
+              hash = checksum(hash, buffers.directions, 6 * sizeof(int));
+            }
+            hash = checksum(hash, buffers.connections, sizeof(int));
+          }
+        }
+      }
+      if (elapsed < best) best = elapsed;
+    }
+    beginReport(&test, meshModes[mode].name, best, volume, "faces", faces);
+#ifdef VOXELS_COUNTERS
+    printf(
+      ",\"corners_per_face\":%.2f,\"reads_per_face\":%.2f",
+      faces > 0 ? voxelsCounters.corners / faces : 0, faces > 0 ? voxelsCounters.reads / faces : 0
+    );
+#endif
+    endReport(hash);
+    report(&test, meshModes[mode].perChunk, best / chunks, 0, "chunks", chunks, hash);
+  }
+
+  {
+    // Same chunks & checksum as mesh, in batches
+    for (int z = 0, i = 0; z < chunksZ; z++) {
+      for (int y = 0; y < chunksY; y++) {
+        for (int x = 0; x < chunksX; x++, i++) {
+          buffers.meshList[i * 4] = x * chunkSize;
+          buffers.meshList[i * 4 + 1] = y * chunkSize;
+          buffers.meshList[i * 4 + 2] = z * chunkSize;
+          buffers.meshList[i * 4 + 3] = 0;
+        }
+      }
+    }
+    double best = INFINITY;
+    unsigned int hash;
+    double faces, batches;
+    for (int i = 0; i < repeat; i++) {
+      hash = 2166136261u;
+      faces = batches = 0;
+      double elapsed = 0;
+      for (int offset = 0; offset < chunks;) {
+        const double start = now();
+        const int count = meshChunks(
+          world, &buffers.voxels, buffers.meshBounds, buffers.meshFaces, buffers.meshDirections, buffers.meshConnections,
+          buffers.vertices, buffers.neighbors,
+          &buffers.meshList[offset * 4], chunks - offset, buffers.meshCapacity, chunkSize, false
+        );
+        elapsed += now() - start;
+        batches++;
+        for (int c = 0; c < count; c++) {
+          const int first = buffers.meshFaces[c * 2],
+                    chunkFaces = buffers.meshFaces[c * 2 + 1];
+          faces += chunkFaces;
+          hash = checksum(hash, &buffers.vertices[first * 4 * 8], chunkFaces * 4 * 8);
+          if (chunkFaces > 0) {
+            hash = checksum(hash, &buffers.meshBounds[c * 4], 4 * sizeof(float));
+            hash = checksum(hash, &buffers.meshDirections[c * 6], 6 * sizeof(int));
+          }
+          hash = checksum(hash, &buffers.meshConnections[c], sizeof(int));
+        }
+        offset += count;
+      }
+      if (elapsed < best) best = elapsed;
+    }
+    report(&test, "mesh_chunks", best, volume, "faces", faces, hash);
+    report(&test, "mesh_chunks_batches", best / batches, 0, "batches", batches, hash);
+  }
+
+  {
+    double best = INFINITY;
+    unsigned int hash;
+    double boxes;
+    for (int i = 0; i < repeat; i++) {
+      hash = 2166136261u;
+      boxes = 0;
+      double elapsed = 0;
+      for (int z = 0; z < chunksZ; z++) {
+        for (int y = 0; y < chunksY; y++) {
+          for (int x = 0; x < chunksX; x++) {
+            unsigned int boxesHash;
+            const double start = now();
+            const int count = colliders(
+              world, &buffers.voxels, buffers.colliderBoxes, &boxesHash, buffers.colliderRows,
+              chunkSize, x * chunkSize, y * chunkSize, z * chunkSize
+            );
+            elapsed += now() - start;
+            boxes += count;
+            hash = checksum(hash, buffers.colliderBoxes, count * 6);
+          }
+        }
+      }
+      if (elapsed < best) best = elapsed;
+    }
+    report(&test, "colliders", best, volume, "boxes", boxes, hash);
+  }
+
+  {
+    Offset sphere[(brushSize * 2 + 1) * (brushSize * 2 + 1) * (brushSize * 2 + 1)];
+    const int brushVoxels = getSphereBrush(sphere, brushSize);
+    // update: One call per voxel (like it used to be done from JS)
+    // brush: One call per brush (same voxels, so it should produce the same checksums)
+    // brush_noise: Same as brush_stone with a seeded color noise
+    static const struct {
+      const char* name;
+      const unsigned char type;
+      const bool batched;
+      const float noise;
+    } cases[] = {
+      { "update_stone", TYPE_STONE, false, 0 },
+      { "update_light", TYPE_LIGHT, false, 0 },
+      { "update_air", TYPE_AIR, false, 0 },
+      { "brush_stone", TYPE_STONE, true, 0 },
+      { "brush_light", TYPE_LIGHT, true, 0 },
+      { "brush_air", TYPE_AIR, true, 0 },
+      { "brush_noise", TYPE_STONE, true, 0.5f },
+    };
+    for (int t = 0; t < (int) (sizeof(cases) / sizeof(cases[0])); t++) {
+      double best = INFINITY;
+      unsigned int hash;
+      unsigned int dirtyHash;
+      double dirtyChunks;
+      for (int i = 0; i < repeat; i++) {
+        dirtyHash = 2166136261u;
+        dirtyChunks = 0;
+        loadSnapshot(&buffers, &voxels);
+        memcpy(buffers.heightmap, heightmap, buffers.heightmapSize);
+        srand(seed);
+        double elapsed = 0;
+        for (int b = 0; b < brushes; b++) {
+          const int x = brushSize + 1 + rand() % (size->width - brushSize * 2 - 2),
+                    z = brushSize + 1 + rand() % (size->depth - brushSize * 2 - 2),
+                    y = getHeight(world, buffers.heightmap, x, z);
+          const unsigned char r = rand(), g = rand(), bl = rand();
+          const double start = now();
+          if (cases[t].batched) {
+            brush(
+              world, buffers.heightmap, &buffers.voxels,
+              buffers.lightQueues,
+              BRUSH_SPHERE, brushSize, cases[t].type,
+              x, y, z,
+              r, g, bl,
+              cases[t].noise, seed + b
+            );
+          } else {
+            for (int v = 0; v < brushVoxels; v++) {
+              update(
+                world, buffers.heightmap, &buffers.voxels,
+                buffers.lightQueues,
+                cases[t].type,
+                x + sphere[v].x, y + sphere[v].y, z + sphere[v].z,
+                r, g, bl
+              );
+            }
+          }
+          elapsed += now() - start;
+          // Chunks the client would remesh
+          dirtyHash = checksum(dirtyHash, buffers.dirty->chunks, buffers.chunks);
+          dirtyChunks += buffers.dirty->count;
+          memset(buffers.dirty->chunks, 0, buffers.chunks);
+          buffers.dirty->count = 0;
+        }
+        if (elapsed < best) best = elapsed;
+        hash = checksum(checksumVoxels(2166136261u, &buffers), buffers.heightmap, buffers.heightmapSize);
+      }
+      beginReport(&test, cases[t].name, best, (double) brushes * brushVoxels, "brushes", brushes);
+      printf(",\"dirty_chunks\":%.0f,\"dirty_checksum\":\"%08x\"", dirtyChunks, dirtyHash);
+      endReport(hash);
+    }
+    loadSnapshot(&buffers, &voxels);
+    memcpy(buffers.heightmap, heightmap, buffers.heightmapSize);
+  }
+
+  {
+    // Light brushes, relighting the meshes of the chunks where only the light changed
+    // (and remeshing the rest, like core/gameplay.js does).
+    // The meshes must end up the same as meshing every chunk from scratch.
+    // relight_remesh: Remeshing the same chunks instead, for comparison.
+    unsigned char** meshes = allocate(chunks * sizeof(unsigned char*));
+    int* meshFaces = allocate(chunks * sizeof(int));
+    unsigned char* light = allocate(chunkSize * chunkSize * chunkSize * 3 * 4 * LIGHT_STRIDE);
+    double best = INFINITY;
+    double bestRemesh = INFINITY;
+    double relit;
+    for (int i = 0; i < repeat; i++) {
+      relit = 0;
+      loadSnapshot(&buffers, &voxels);
+      memcpy(buffers.heightmap, heightmap, buffers.heightmapSize);
+      for (int z = 0, c = 0; z < chunksZ; z++) {
+        for (int y = 0; y < chunksY; y++) {
+          for (int x = 0; x < chunksX; x++, c++) {
+            storeMesh(&buffers, &meshes[c], &meshFaces[c], x, y, z);
+          }
+        }
+      }
+      memset(buffers.dirty->chunks, 0, buffers.chunks);
+      buffers.dirty->count = 0;
+      srand(seed);
+      double elapsed = 0;
+      double remeshElapsed = 0;
+      for (int b = 0; b < brushes; b++) {
+        const int x = brushSize + 1 + rand() % (size->width - brushSize * 2 - 2),
+                  z = brushSize + 1 + rand() % (size->depth - brushSize * 2 - 2),
+                  y = getHeight(world, buffers.heightmap, x, z);
+        const unsigned char r = rand(), g = rand(), bl = rand();
+        brush(
+          world, buffers.heightmap, &buffers.voxels,
+          buffers.lightQueues,
+          BRUSH_SPHERE, brushSize, TYPE_LIGHT,
+          x, y, z,
+          r, g, bl,
+          0, 0
+        );
+        for (int d = 0; d < buffers.dirty->count; d++) {
+          const int c = buffers.dirty->list[d],
+                    cx = c % chunksX,
+                    cy = (c / chunksX) % chunksY,
+                    cz = c / (chunksX * chunksY);
+          const unsigned char flags = buffers.dirty->chunks[c];
+          buffers.dirty->chunks[c] = 0;
+          if (flags & CHUNK_MESH) {
+            storeMesh(&buffers, &meshes[c], &meshFaces[c], cx, cy, cz);
+          } else if ((flags & CHUNK_LIGHT) && meshFaces[c] > 0) {
+            double start = now();
+            const int count = relight(
+              world, &buffers.voxels, meshes[c], light, buffers.neighbors, meshFaces[c],
+              chunkSize, 0, cx * chunkSize, cy * chunkSize, cz * chunkSize
+            );
+            elapsed += now() - start;
+            if (count == -1) {
+              storeMesh(&buffers, &meshes[c], &meshFaces[c], cx, cy, cz);
+              continue;
+            }
+            relit++;
+            for (int v = 0; v < count * 4; v++) {
+              meshes[c][v * 8 + 6] = light[v * LIGHT_STRIDE + VOXEL_LIGHT];
+              meshes[c][v * 8 + 7] = light[v * LIGHT_STRIDE + VOXEL_SUNLIGHT];
+            }
+            start = now();
+            mesh(
+              world, &buffers.voxels, buffers.bounds, buffers.directions, buffers.connections, buffers.vertices, buffers.neighbors,
+              chunkSize, false, 0, cx * chunkSize, cy * chunkSize, cz * chunkSize
+            );
+            remeshElapsed += now() - start;
+          }
+        }
+        buffers.dirty->count = 0;
+      }
+      if (elapsed < best) best = elapsed;
+      if (remeshElapsed < bestRemesh) bestRemesh = remeshElapsed;
+    }
+    unsigned int hash = 2166136261u;
+    unsigned int remeshHash = 2166136261u;
+    for (int z = 0, c = 0; z < chunksZ; z++) {
+      for (int y = 0; y < chunksY; y++) {
+        for (int x = 0; x < chunksX; x++, c++) {
+          hash = checksum(hash, meshes[c], meshFaces[c] * 4 * 8);
+          const int count = mesh(
+            world, &buffers.voxels, buffers.bounds, buffers.directions, buffers.connections, buffers.vertices, buffers.neighbors,
+            chunkSize, false, 0, x * chunkSize, y * chunkSize, z * chunkSize
+          );
+          remeshHash = checksum(remeshHash, buffers.vertices, count * 4 * 8);
+          free(meshes[c]);
+        }
+      }
+    }
+    free(meshes);
+    free(meshFaces);
+    free(light);
+    if (hash != remeshHash) {
+      fprintf(stderr, "relight doesn't match a full remesh (%08x != %08x)\n", hash, remeshHash);
+      exit(1);
+    }
+    report(&test, "relight", best, 0, "chunks", relit, hash);
+    report(&test, "relight_remesh", bestRemesh, 0, "chunks", relit, remeshHash);
+    loadSnapshot(&buffers, &voxels);
+    memcpy(buffers.heightmap, heightmap, buffers.heightmapSize);
+  }
+
+  {
+    double bestTarget = INFINITY;
+    double bestPath = INFINITY;
+    unsigned int targetHash;
+    unsigned int pathHash;
+    double targets;
+    double waypoints;
+    for (int i = 0; i < repeat; i++) {
+      targetHash = pathHash = 2166136261u;
+      targets = waypoints = 0;
+      double targetElapsed = 0;
+      double pathElapsed = 0;
+      srand(seed);
+      for (int p = 0; p < paths; p++) {
+        const int x = size->width / 2 - searchRadius / 2 + rand() % searchRadius,
+                  z = size->depth / 2 - searchRadius / 2 + rand() % searchRadius,
+                  ground = findGround(world, buffers.heightmap, &buffers.voxels, false, agentHeight, x, size->height - agentHeight - 2, z);
+        if (ground == 0) {
+          continue;
+        }
+        int point[3];
+        double start = now();
+        const unsigned char found = findTarget(
+          world, buffers.heightmap, &buffers.voxels, buffers.obstacles, point,
+          agentHeight, searchRadius, x, ground + 1, z
+        );
+        targetElapsed += now() - start;
+        targets++;
+        targetHash = checksum(targetHash, &found, 1);
+        if (!found) {
+          continue;
+        }
+        targetHash = checksum(targetHash, point, sizeof(point));
+        start = now();
+        const int count = findPath(
+          world, &buffers.voxels, buffers.obstacles, buffers.queueA,
+          agentHeight, x, ground + 1, z, point[0], point[1], point[2]
+        );
+        pathElapsed += now() - start;
+        if (count > 0) {
+          waypoints += count;
+          pathHash = checksum(pathHash, buffers.queueA, count * 4 * sizeof(int));
+        }
+      }
+      if (targetElapsed < bestTarget) bestTarget = targetElapsed;
+      if (pathElapsed < bestPath) bestPath = pathElapsed;
+    }
+    report(&test, "findTarget", bestTarget, 0, "queries", targets, targetHash);
+    report(&test, "findPath", bestPath, 0, "waypoints", waypoints, pathHash);
+  }
+
+  {
+    // Rays from above the world towards random points of it (like picking from the sky)
+    double best = INFINITY;
+    unsigned int hash;
+    double hits;
+    for (int i = 0; i < repeat; i++) {
+      hash = 2166136261u;
+      hits = 0;
+      double elapsed = 0;
+      srand(seed);
+      for (int r = 0; r < rays; r++) {
+        const float originX = rand() % size->width,
+                    originY = size->height + 8,
+                    originZ = rand() % size->depth;
+        float directionX = rand() % size->width - originX,
+              directionY = -originY,
+              directionZ = rand() % size->depth - originZ;
+        const float length = sqrtf(directionX * directionX + directionY * directionY + directionZ * directionZ);
+        directionX /= length;
+        directionY /= length;
+        directionZ /= length;
+        int hit[6];
+        const double start = now();
+        const float distance = raycast(
+          world, &buffers.voxels, hit,
+          originX, originY, originZ, directionX, directionY, directionZ, rayDistance
+        );
+        elapsed += now() - start;
+        if (distance >= 0) {
+          hits++;
+          hash = checksum(hash, hit, sizeof(hit));
+        }
+      }
+      if (elapsed < best) best = elapsed;
+    }
+    report(&test, "raycast", best, 0, "hits", hits, hash);
+  }
+
+  {
+    // Characters walking in random directions with gravity, sliding on & stepping onto the voxels
+    double best = INFINITY;
+    unsigned int hash;
+    double moves;
+    for (int i = 0; i < repeat; i++) {
+      hash = 2166136261u;
+      moves = 0;
+      double elapsed = 0;
+      srand(seed);
+      for (int w = 0; w < walkers; w++) {
+        float position[] = { rand() % size->width + 0.5f, size->height - agentHeight - 1, rand() % size->depth + 0.5f };
+        const float angle = (rand() % 360) * (float) M_PI / 180;
+        const double start = now();
+        for (int s = 0; s < walkerSteps; s++) {
+          sweep(
+            world, &buffers.voxels, position,
+            0.4f, agentHeight - 0.5f, 1.1f, cosf(angle) * 0.2f, -0.5f, sinf(angle) * 0.2f
+          );
+        }
+        elapsed += now() - start;
+        moves += walkerSteps;
+        hash = checksum(hash, position, sizeof(position));
+      }
+      if (elapsed < best) best = elapsed;
+    }
+    report(&test, "sweep", best, 0, "moves", moves, hash);
+  }
+
+  destroySnapshot(&voxels);
+  free(heightmap);
+  destroyBuffers(&buffers);
+}
+
+static bool isSelected(const char* name, char** filters, const int count) {
+  if (count == 0) {
+    return true;
+  }
+  for (int i = 0; i < count; i++) {
+    if (strcmp(name, filters[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int main(int argc, char** argv) {
+  int repeat = 3;
+  char* sizeFilters[argc];
+  char* generatorFilters[argc];
+  char* storageFilters[argc];
+  int sizeCount = 0;
+  int generatorCount = 0;
+  int storageCount = 0;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 < argc && strcmp(argv[i], "--repeat") == 0) {
+      repeat = atoi(argv[++i]);
+    } else if (i + 1 < argc && strcmp(argv[i], "--size") == 0) {
+      sizeFilters[sizeCount++] = argv[++i];
+    } else if (i + 1 < argc && strcmp(argv[i], "--generator") == 0) {
+      generatorFilters[generatorCount++] = argv[++i];
+    } else if (i + 1 < argc && strcmp(argv[i], "--storage") == 0) {
+      storageFilters[storageCount++] = argv[++i];
+    } else {
+      fprintf(stderr, "Usage: %s [--repeat N] [--size small|medium|large] [--generator name] [--storage linear|bricked|sparse]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (repeat < 1) {
+    repeat = 1;
+  }
+  if (sizeCount == 0) {
+    // The large worlds take a while. Only run them on demand.
+    sizeFilters[sizeCount++] = "small";
+    sizeFilters[sizeCount++] = "medium";
+  }
+  for (int s = 0; s < sizeof(sizes) / sizeof(BenchmarkSize); s++) {
+    if (!isSelected(sizes[s].name, sizeFilters, sizeCount)) {
+      continue;
+    }
+    for (int g = 0; g < sizeof(generators) / sizeof(BenchmarkGenerator); g++) {
+      if (!isSelected(generators[g].name, generatorFilters, generatorCount)) {
+        continue;
+      }
+      for (int l = 0; l < sizeof(storages) / sizeof(BenchmarkStorage); l++) {
+        if (!isSelected(storages[l].name, storageFilters, storageCount)) {
+          continue;
+        }
+        benchmark(&generators[g], &sizes[s], &storages[l], repeat);
+      }
+    }
+  }
+  return 0;
+}
@@ -12,7 +12,11 @@ cd "${0%/*}"
 clang --target=wasm32-unknown-wasi --sysroot=../../vendor/wasi-libc/sysroot -nostartfiles -flto -Ofast \
 -Wl,--import-memory -Wl,--no-entry -Wl,--lto-O3 \
 -Wl,--export=malloc \
+-Wl,--export=realloc \
+-Wl,--export=brush \
+-Wl,--export=clear \
 -Wl,--export=colliders \
+-Wl,--export=compact \
 -Wl,--export=findGround \
 -Wl,--export=findPath \
 -Wl,--export=findTarget \
@@ -21,6 +25,12 @@ clang --target=wasm32-unknown-wasi --sysroot=../../vendor/wasi-libc/sysroot -nos
 -Wl,--export=getLight \
 -Wl,--export=heightmap \
 -Wl,--export=mesh \
+-Wl,--export=meshChunks \
 -Wl,--export=propagate \
+-Wl,--export=raycast \
+-Wl,--export=relight \
+-Wl,--export=sweep \
+-Wl,--export=transcode \
+-Wl,--export=unshare \
 -Wl,--export=update \
 -o ../voxels.wasm voxels.c
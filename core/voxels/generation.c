@@ -33,7 +33,7 @@ static const unsigned int hsl2Rgb(float h, float s, float l) {
   );
 }
 
-const float frand() {
+static const float frand() {
   return (float) rand() / (float) (RAND_MAX);
 }
 
@@ -67,7 +67,7 @@ static const unsigned int getColorFromNoise(unsigned char noise) {
 //          and always updates the heightmap.
 static void setVoxel(
   const World* world,
-  unsigned char* voxels,
+  const Voxels* voxels,
   int* heightmap,
   const int x,
   const int y,
@@ -76,14 +76,17 @@ static void setVoxel(
   const unsigned int color,
   const unsigned char noise
 ) {
-  const int voxel = getVoxel(world, x, y, z);
-  voxels[voxel] = type;
-  voxels[voxel + VOXEL_R] = fmin(fmax((int) ((color >> 16) & 0xFF) + (noise ? (rand() % noise) * (type == TYPE_LIGHT ? 2 : -1) : 0), 0), 0xFF);
-  voxels[voxel + VOXEL_G] = fmin(fmax((int) ((color >> 8) & 0xFF) + (noise ? (rand() % noise) * (type == TYPE_LIGHT ? 2 : -1) : 0), 0), 0xFF);
-  voxels[voxel + VOXEL_B] = fmin(fmax((int) (color & 0xFF) + (noise ? (rand() % noise) * (type == TYPE_LIGHT ? 2 : -1) : 0), 0), 0xFF);
+  const int voxel = unshare(world, voxels, x, y, z);
+  if (voxel == -1) {
+    return;
+  }
+  voxels->types[voxel] = type;
+  voxels->colors[voxel * COLORS_STRIDE + VOXEL_R] = fmin(fmax((int) ((color >> 16) & 0xFF) + (noise ? (rand() % noise) * (type == TYPE_LIGHT ? 2 : -1) : 0), 0), 0xFF);
+  voxels->colors[voxel * COLORS_STRIDE + VOXEL_G] = fmin(fmax((int) ((color >> 8) & 0xFF) + (noise ? (rand() % noise) * (type == TYPE_LIGHT ? 2 : -1) : 0), 0), 0xFF);
+  voxels->colors[voxel * COLORS_STRIDE + VOXEL_B] = fmin(fmax((int) (color & 0xFF) + (noise ? (rand() % noise) * (type == TYPE_LIGHT ? 2 : -1) : 0), 0), 0xFF);
   if (y < world->seaLevel) {
-    voxels[voxel + VOXEL_R] /= 2;
-    voxels[voxel + VOXEL_G] /= 2;
+    voxels->colors[voxel * COLORS_STRIDE + VOXEL_R] /= 2;
+    voxels->colors[voxel * COLORS_STRIDE + VOXEL_G] /= 2;
   }
   const int heightmapIndex = z * world->width + x;
   if (heightmap[heightmapIndex] < y) {
@@ -93,7 +96,7 @@ static void setVoxel(
 
 static void generateBillboard(
   const World* world,
-  unsigned char* voxels,
+  const Voxels* voxels,
   int* heightmap,
   const int x,
   const int y,
@@ -137,7 +140,7 @@ static void generateBillboard(
 
 static void generateBuilding(
   const World* world,
-  unsigned char* voxels,
+  const Voxels* voxels,
   int* heightmap,
   const int x,
   const int z,
@@ -258,7 +261,7 @@ static void generateBuilding(
 
 static void generateTerrain(
   const World* world,
-  unsigned char* voxels,
+  const Voxels* voxels,
   int* heightmap,
   const int maxHeight,
   const int innerRadius,
@@ -296,7 +299,7 @@ static void generateTerrain(
 
 static void generateTerrainLamps(
   const World* world,
-  unsigned char* voxels,
+  const Voxels* voxels,
   int* heightmap
 ) {
   const int grid = 32;
@@ -308,13 +311,13 @@ static void generateTerrainLamps(
       const int voxel = getVoxel(world, lx, y, lz);
       if (
         y >= world->seaLevel
-        && voxels[voxel] == TYPE_DIRT
+        && voxels->types[voxel] == TYPE_DIRT
         && rand() % 2 == 0
       ) {
         const unsigned int color = (
-          (voxels[voxel + VOXEL_R] << 16)
-          | (voxels[voxel + VOXEL_G] << 8)
-          | voxels[voxel + VOXEL_B]
+          (voxels->colors[voxel * COLORS_STRIDE + VOXEL_R] << 16)
+          | (voxels->colors[voxel * COLORS_STRIDE + VOXEL_G] << 8)
+          | voxels->colors[voxel * COLORS_STRIDE + VOXEL_B]
         );
         for (int i = 1; i < 3; i++) {
           setVoxel(
@@ -340,7 +343,7 @@ static const int branchOffsets[] = {
 
 static void growTree(
   const World* world,
-  unsigned char* voxels,
+  const Voxels* voxels,
   int* heightmap,
   const unsigned int color,
   const int trunk,
@@ -352,24 +355,25 @@ static void growTree(
 ) {
   unsigned int nextLength = 0;
   for (unsigned int i = 0; i < queueLength; i += 2) {
-    const int voxel = queue[i];
+    const int position = queue[i];
     const int distance = queue[i + 1];
-    const int index = voxel / VOXELS_STRIDE,
-          z = floor(index / (world->width * world->height)),
-          y = floor((index % (world->width * world->height)) / world->width),
-          x = floor((index % (world->width * world->height)) % world->width);
+    int x, y, z;
+    unpackPosition(world, position, &x, &y, &z);
     const bool isTrunk = distance <= trunk;
     if (isTrunk) {
       for (int j = -1; j <= 1; j++) {
         for (int k = -1; k <= 1; k++) {
-          const int n = getVoxel(world, x + j, y, z + k);
-          voxels[n] = TYPE_TREE;
-          voxels[n + VOXEL_R] = fmax((int) ((color >> 16) & 0xFF) / 2 - (rand() % 0x11), 0);
-          voxels[n + VOXEL_G] = fmax((int) ((color >> 8) & 0xFF) / 2 - (rand() % 0x11), 0);
-          voxels[n + VOXEL_B] = fmax((int) (color & 0xFF) / 2 - (rand() % 0x11), 0);
+          const int n = unshare(world, voxels, x + j, y, z + k);
+          if (n == -1) {
+            continue;
+          }
+          voxels->types[n] = TYPE_TREE;
+          voxels->colors[n * COLORS_STRIDE + VOXEL_R] = fmax((int) ((color >> 16) & 0xFF) / 2 - (rand() % 0x11), 0);
+          voxels->colors[n * COLORS_STRIDE + VOXEL_G] = fmax((int) ((color >> 8) & 0xFF) / 2 - (rand() % 0x11), 0);
+          voxels->colors[n * COLORS_STRIDE + VOXEL_B] = fmax((int) (color & 0xFF) / 2 - (rand() % 0x11), 0);
           if (y < world->seaLevel) {
-            voxels[n + VOXEL_R] /= 2;
-            voxels[n + VOXEL_G] /= 2;
+            voxels->colors[n * COLORS_STRIDE + VOXEL_R] /= 2;
+            voxels->colors[n * COLORS_STRIDE + VOXEL_G] /= 2;
           }
           const int heightmapIndex = (z + k) * world->width + (x + j);
           if (heightmap[heightmapIndex] < y) {
@@ -379,15 +383,19 @@ static void growTree(
       }
     } else {
       const int f = floor(((distance - trunk) / size) * 0x33);
-      voxels[voxel] = TYPE_TREE;
+      const int voxel = unshare(world, voxels, x, y, z);
+      if (voxel == -1) {
+        continue;
+      }
+      voxels->types[voxel] = TYPE_TREE;
       if (distance < branches) {
-        voxels[voxel + VOXEL_R] = fmin(fmax((int) ((color >> 16) & 0xFF) / 2 + f - (rand() % 0x11), 0), 0xFF);
-        voxels[voxel + VOXEL_G] = fmin(fmax((int) ((color >> 8) & 0xFF) / 2 + f - (rand() % 0x11), 0), 0xFF);
-        voxels[voxel + VOXEL_B] = fmin(fmax((int) (color & 0xFF) / 2 + f - (rand() % 0x11), 0), 0xFF);
+        voxels->colors[voxel * COLORS_STRIDE + VOXEL_R] = fmin(fmax((int) ((color >> 16) & 0xFF) / 2 + f - (rand() % 0x11), 0), 0xFF);
+        voxels->colors[voxel * COLORS_STRIDE + VOXEL_G] = fmin(fmax((int) ((color >> 8) & 0xFF) / 2 + f - (rand() % 0x11), 0), 0xFF);
+        voxels->colors[voxel * COLORS_STRIDE + VOXEL_B] = fmin(fmax((int) (color & 0xFF) / 2 + f - (rand() % 0x11), 0), 0xFF);
       } else {
-        voxels[voxel + VOXEL_R] = fmin(fmax((int) ((color >> 16) & 0xFF) + f - (rand() % 0x11), 0), 0xFF);
-        voxels[voxel + VOXEL_G] = fmin(fmax((int) ((color >> 8) & 0xFF) + f - (rand() % 0x11), 0), 0xFF);
-        voxels[voxel + VOXEL_B] = fmin(fmax((int) (color & 0xFF) + f - (rand() % 0x11), 0), 0xFF);
+        voxels->colors[voxel * COLORS_STRIDE + VOXEL_R] = fmin(fmax((int) ((color >> 16) & 0xFF) + f - (rand() % 0x11), 0), 0xFF);
+        voxels->colors[voxel * COLORS_STRIDE + VOXEL_G] = fmin(fmax((int) ((color >> 8) & 0xFF) + f - (rand() % 0x11), 0), 0xFF);
+        voxels->colors[voxel * COLORS_STRIDE + VOXEL_B] = fmin(fmax((int) (color & 0xFF) + f - (rand() % 0x11), 0), 0xFF);
       }
       const int heightmapIndex = z * world->width + x;
       if (heightmap[heightmapIndex] < y) {
@@ -396,28 +404,34 @@ static void growTree(
     }
     if (distance == trunk) {
       for (int j = 0; j < 15; j += 3) {
-        const int n = getVoxel(world, x + branchOffsets[j], y + branchOffsets[j + 1], z + branchOffsets[j + 2]);
-        if (n != -1 && voxels[n] == TYPE_AIR) {
-          next[nextLength++] = n; 
+        const int nx = x + branchOffsets[j],
+                  ny = y + branchOffsets[j + 1],
+                  nz = z + branchOffsets[j + 2],
+                  n = getVoxel(world, nx, ny, nz);
+        if (n != -1 && voxels->types[n] == TYPE_AIR) {
+          next[nextLength++] = packPosition(world, nx, ny, nz); 
           next[nextLength++] = distance + 1; 
         }
       }
     } else if (isTrunk) {
       const int n = getVoxel(world, x, y + 1, z);
-      if (n != -1 && (distance < 2 || voxels[n] == TYPE_AIR)) {
-        next[nextLength++] = n; 
+      if (n != -1 && (distance < 2 || voxels->types[n] == TYPE_AIR)) {
+        next[nextLength++] = packPosition(world, x, y + 1, z); 
         next[nextLength++] = distance + 1; 
       } else if (distance > trunk * 0.25f) {
-        next[nextLength++] = voxel; 
+        next[nextLength++] = position; 
         next[nextLength++] = trunk; 
       }
     } else if (distance < size) {
       int count = 0;
       for (int j = 0; j < 6; j++) {
         const int ni = rand() % 6;
-        const int n = getVoxel(world, x + neighbors[ni * 3], y + neighbors[ni * 3 + 1], z + neighbors[ni * 3 + 2]);
-        if (n != -1 && voxels[n] == TYPE_AIR) {
-          next[nextLength++] = n; 
+        const int nx = x + neighbors[ni * 3],
+                  ny = y + neighbors[ni * 3 + 1],
+                  nz = z + neighbors[ni * 3 + 2],
+                  n = getVoxel(world, nx, ny, nz);
+        if (n != -1 && voxels->types[n] == TYPE_AIR) {
+          next[nextLength++] = packPosition(world, nx, ny, nz); 
           next[nextLength++] = distance + 1;
           count++;
           if (count >= 2) {
@@ -445,7 +459,7 @@ static void growTree(
 
 static void generateTree(
   const World* world,
-  unsigned char* voxels,
+  const Voxels* voxels,
   int* heightmap,
   const int x,
   const int y,
@@ -456,7 +470,7 @@ static void generateTree(
   int* queueA,
   int* queueB
 ) {
-  queueA[0] = getVoxel(world, x, fmax(y - 1, 0), z);
+  queueA[0] = packPosition(world, x, fmax(y - 1, 0), z);
   queueA[1] = 0;
   growTree(
     world,
@@ -474,7 +488,7 @@ static void generateTree(
 
 static void generateDebugCity(
   const World* world,
-  unsigned char* voxels,
+  const Voxels* voxels,
   int* heightmap
 ) {
   const int grid = 80;
@@ -545,7 +559,7 @@ static void generateDebugCity(
 
 static void generatePartyBuildings(
   const World* world,
-  unsigned char* voxels,
+  const Voxels* voxels,
   int* heightmap,
   int* queueA
 ) {
@@ -564,7 +578,7 @@ static void generatePartyBuildings(
     for (int i = 0; i < count - 1; i++) {
       queueA[i] = (i + 3) * step;
     }
-    for (int i = count - 2; i >= 0; i--) {
+    for (int i = count - 2; i > 0; i--) {
       const int random = rand() % i;
       const int temp = queueA[i];
       queueA[i] = queueA[random];
@@ -720,7 +734,7 @@ static void generatePartyBuildings(
 
 static void generateBlank(
   const World* world,
-  unsigned char* voxels,
+  const Voxels* voxels,
   int* heightmap
 ) {
   for (int z = 1; z < world->depth - 1; z++) {
@@ -738,7 +752,7 @@ static void generateBlank(
 
 static void generatePit(
   const World* world,
-  unsigned char* voxels,
+  const Voxels* voxels,
   int* heightmap,
   const int seed
 ) {
@@ -774,20 +788,10 @@ static void generatePit(
   }
 }
 
-enum Generators {
-  GENERATOR_BLANK,
-  GENERATOR_DEFAULT,
-  GENERATOR_MENU,
-  GENERATOR_DEBUG_CITY,
-  GENERATOR_PARTY_BUILDINGS,
-  GENERATOR_PIT,
-  GENERATOR_SCULPT
-};
-
 void generate(
   const World* world,
   int* heightmap,
-  unsigned char* voxels,
+  const Voxels* voxels,
   int* queueA,
   int* queueB,
   const unsigned char generator,
@@ -867,7 +871,7 @@ void generate(
         const int y = heightmap[tz * world->width + tx];
         if (
           y >= minY
-          && voxels[getVoxel(world, tx, y, tz)] == TYPE_DIRT
+          && voxels->types[getVoxel(world, tx, y, tz)] == TYPE_DIRT
           && rand() % 2 == 0
         ) {
           const int size = 10 + rand() % 10;
@@ -893,12 +897,12 @@ void generate(
 void heightmap(
   const World* world,
   int* heightmap,
-  const unsigned char* voxels
+  const Voxels* voxels
 ) {
   for (int z = 0, index = 0; z < world->depth; z++) {
     for (int x = 0; x < world->width; x++, index++) {
       for (int y = world->height - 1; y >= 0; y--) {
-        if (y == 0 || voxels[getVoxel(world, x, y, z)] != TYPE_AIR) {
+        if (y == 0 || voxels->types[getVoxel(world, x, y, z)] != TYPE_AIR) {
           heightmap[index] = y;
           break;
         }
@@ -1,12 +1,54 @@
+// Padded copy of the chunk and its neighbors, gathered once per chunk so the faces,
+// AO & light can be looked up with constant offsets instead of bounds checked getVoxel calls
+enum NeighborhoodFields {
+  NEIGHBORHOOD_TYPE,
+  NEIGHBORHOOD_LIGHT,
+  NEIGHBORHOOD_SUNLIGHT,
+  NEIGHBORHOOD_STRIDE
+};
+
+// Type of the cells outside of the world (neither air nor solid)
+static const unsigned char outsideType = 0xFF;
+
+// Coarsest level of detail (4x downsampled)
+static const unsigned char maxLOD = 2;
+
+#ifdef VOXELS_COUNTERS
+VoxelsCounters voxelsCounters;
+#define COUNT(counter, amount) (voxelsCounters.counter += (amount))
+#else
+#define COUNT(counter, amount)
+#endif
+
+typedef struct {
+  const unsigned char* cells;
+  const unsigned char* colors;   // Colors of the downsampled cells (NULL: read them from the world)
+  const unsigned long long* air; // Air bit of every cell, in rows of words along x
+  int words;                     // Words per row
+  int size;                      // Cells per side (chunkSize / scale + 2)
+  int scale;                     // Voxels per cell side (1 << lod)
+  int origin[3];                 // Chunk origin (in voxels)
+  int faces[6];                  // Offset to the neighbor of every face
+  int corners[6 * 4 * 3];        // Offset to the neighbors of every corner of every face
+  // Lighting of the face corners, so the faces that share a corner compute it once.
+  // It only keeps two planes of corners (by z parity), with the rows of every face direction.
+  unsigned int* lighting;
+  unsigned long long* lit;       // Bit of every cached corner, in rows of words along x
+  int latticeWords;              // Words per row of corners
+  // Flood fill of the air of the chunk (see getConnections)
+  unsigned long long* reached;   // Air bits that were reached (same rows as air)
+  unsigned long long* pending;   // Air bits that were reached but not spread yet
+  int* rows;                     // Stack of the rows with pending bits
+} Neighborhood;
+
 static const unsigned char getAO(
-  const unsigned char* voxels,
-  const int n1,
-  const int n2,
-  const int n3
+  const unsigned char* n1,
+  const unsigned char* n2,
+  const unsigned char* n3
 ) {
-  const bool v1 = n1 != -1 && voxels[n1] != TYPE_AIR,
-             v2 = n2 != -1 && voxels[n2] != TYPE_AIR,
-             v3 = n3 != -1 && voxels[n3] != TYPE_AIR;
+  const bool v1 = n1[NEIGHBORHOOD_TYPE] != TYPE_AIR && n1[NEIGHBORHOOD_TYPE] != outsideType,
+             v2 = n2[NEIGHBORHOOD_TYPE] != TYPE_AIR && n2[NEIGHBORHOOD_TYPE] != outsideType,
+             v3 = n3[NEIGHBORHOOD_TYPE] != TYPE_AIR && n3[NEIGHBORHOOD_TYPE] != outsideType;
   unsigned char ao = 0;
   if (v1) ao += 20;
   if (v2) ao += 20;
@@ -15,38 +57,40 @@ static const unsigned char getAO(
 }
 
 static const unsigned int getLighting(
-  const unsigned char* voxels,
   const unsigned char light,
   const unsigned char sunlight,
-  const int n1,
-  const int n2,
-  const int n3
+  const unsigned char* n1,
+  const unsigned char* n2,
+  const unsigned char* n3
 ) {
-  const bool v1 = n1 != -1 && voxels[n1] == TYPE_AIR,
-             v2 = n2 != -1 && voxels[n2] == TYPE_AIR,
-             v3 = n3 != -1 && voxels[n3] == TYPE_AIR;
+  const bool v1 = n1[NEIGHBORHOOD_TYPE] == TYPE_AIR,
+             v2 = n2[NEIGHBORHOOD_TYPE] == TYPE_AIR,
+             v3 = n3[NEIGHBORHOOD_TYPE] == TYPE_AIR;
   unsigned char n = 1;
   float avgLight = light;
   float avgSunlight = sunlight;
   if (v1) {
-    avgLight += voxels[n1 + VOXEL_LIGHT];
-    avgSunlight += voxels[n1 + VOXEL_SUNLIGHT];
+    avgLight += n1[NEIGHBORHOOD_LIGHT];
+    avgSunlight += n1[NEIGHBORHOOD_SUNLIGHT];
     n++;
   }
   if (v2) {
-    avgLight += voxels[n2 + VOXEL_LIGHT];
-    avgSunlight += voxels[n2 + VOXEL_SUNLIGHT];
+    avgLight += n2[NEIGHBORHOOD_LIGHT];
+    avgSunlight += n2[NEIGHBORHOOD_SUNLIGHT];
     n++;
   }
   if ((v1 || v2) && v3) {
-    avgLight += voxels[n3 + VOXEL_LIGHT];
-    avgSunlight += voxels[n3 + VOXEL_SUNLIGHT];
+    avgLight += n3[NEIGHBORHOOD_LIGHT];
+    avgSunlight += n3[NEIGHBORHOOD_SUNLIGHT];
     n++;
   }
+  // The light of the face neighbor, the types of the corner cells & the light of the averaged ones
+  COUNT(corners, 1);
+  COUNT(reads, 2 + 3 + (n - 1) * 2);
   avgLight = avgLight / n / maxLight * 0xFF;
   avgSunlight = avgSunlight / n / maxLight * 0xFF;
   return (
-    (getAO(voxels, n1, n2, n3) << 16) | (((unsigned char) avgLight) << 8) | ((unsigned char) avgSunlight)
+    (getAO(n1, n2, n3) << 16) | (((unsigned char) avgLight) << 8) | ((unsigned char) avgSunlight)
   );
 }
 
@@ -64,10 +108,12 @@ static void growBox(
   if (box[5] < z) box[5] = z;
 }
 
+// Every quad is drawn with the same indices (0, 1, 2, 2, 3, 0 after its first vertex),
+// so all the chunks can share a single index buffer. Flipping the diagonal of a quad
+// rotates the order of its vertices instead.
 static void pushFace(
   unsigned char* box,
   unsigned int* faces,
-  unsigned int* indices,
   unsigned char* vertices,
   const int chunkX, const int chunkY, const int chunkZ,
   const unsigned char r, const unsigned char g, const unsigned char b,
@@ -76,79 +122,731 @@ static void pushFace(
   const int wx3, const int wy3, const int wz3, const unsigned int l3,
   const int wx4, const int wy4, const int wz4, const unsigned int l4
 ) {
-  const float ao1 = ((l1 >> 16) & 0xFF) / 255.0f,
-                      ao2 = ((l2 >> 16) & 0xFF) / 255.0f,
-                      ao3 = ((l3 >> 16) & 0xFF) / 255.0f,
-                      ao4 = ((l4 >> 16) & 0xFF) / 255.0f;
-  const unsigned int  vertex = *faces * 4,
-                      vertexOffset = vertex * 8,
-                      indexOffset = *faces * 6,
-                      flipFace = ao1 + ao3 > ao2 + ao4 ? 1 : 0; // Fixes interpolation anisotropy
-  const unsigned char x1 = wx1 - chunkX,
-                      y1 = wy1 - chunkY,
-                      z1 = wz1 - chunkZ,
-                      x2 = wx2 - chunkX,
-                      y2 = wy2 - chunkY,
-                      z2 = wz2 - chunkZ,
-                      x3 = wx3 - chunkX,
-                      y3 = wy3 - chunkY,
-                      z3 = wz3 - chunkZ,
-                      x4 = wx4 - chunkX,
-                      y4 = wy4 - chunkY,
-                      z4 = wz4 - chunkZ;
+  const unsigned char positions[] = {
+    wx1 - chunkX, wy1 - chunkY, wz1 - chunkZ,
+    wx2 - chunkX, wy2 - chunkY, wz2 - chunkZ,
+    wx3 - chunkX, wy3 - chunkY, wz3 - chunkZ,
+    wx4 - chunkX, wy4 - chunkY, wz4 - chunkZ
+  };
+  const unsigned int lighting[] = { l1, l2, l3, l4 };
+  const float ao[] = {
+    ((l1 >> 16) & 0xFF) / 255.0f,
+    ((l2 >> 16) & 0xFF) / 255.0f,
+    ((l3 >> 16) & 0xFF) / 255.0f,
+    ((l4 >> 16) & 0xFF) / 255.0f
+  };
+  const unsigned char flipFace = ao[0] + ao[2] > ao[1] + ao[3] ? 1 : 0; // Fixes interpolation anisotropy
+  unsigned char* vertex = &vertices[*faces * 4 * 8];
   (*faces)++;
-  // Is this crazy? I dunno. You tell me.
-  vertices[vertexOffset] = x1;
-  vertices[vertexOffset + 1] = y1;
-  vertices[vertexOffset + 2] = z1;
-  vertices[vertexOffset + 3] = r * (1.0f - ao1);
-  vertices[vertexOffset + 4] = g * (1.0f - ao1);
-  vertices[vertexOffset + 5] = b * (1.0f - ao1);
-  vertices[vertexOffset + 6] = (l1 >> 8) & 0xFF;
-  vertices[vertexOffset + 7] = l1 & 0xFF;
-  vertices[vertexOffset + 8] = x2;
-  vertices[vertexOffset + 9] = y2;
-  vertices[vertexOffset + 10] = z2;
-  vertices[vertexOffset + 11] = r * (1.0f - ao2);
-  vertices[vertexOffset + 12] = g * (1.0f - ao2);
-  vertices[vertexOffset + 13] = b * (1.0f - ao2);
-  vertices[vertexOffset + 14] = (l2 >> 8) & 0xFF;
-  vertices[vertexOffset + 15] = l2 & 0xFF;
-  vertices[vertexOffset + 16] = x3;
-  vertices[vertexOffset + 17] = y3;
-  vertices[vertexOffset + 18] = z3;
-  vertices[vertexOffset + 19] = r * (1.0f - ao3);
-  vertices[vertexOffset + 20] = g * (1.0f - ao3);
-  vertices[vertexOffset + 21] = b * (1.0f - ao3);
-  vertices[vertexOffset + 22] = (l3 >> 8) & 0xFF;
-  vertices[vertexOffset + 23] = l3 & 0xFF;
-  vertices[vertexOffset + 24] = x4;
-  vertices[vertexOffset + 25] = y4;
-  vertices[vertexOffset + 26] = z4;
-  vertices[vertexOffset + 27] = r * (1.0f - ao4);
-  vertices[vertexOffset + 28] = g * (1.0f - ao4);
-  vertices[vertexOffset + 29] = b * (1.0f - ao4);
-  vertices[vertexOffset + 30] = (l4 >> 8) & 0xFF;
-  vertices[vertexOffset + 31] = l4 & 0xFF;
-  indices[indexOffset] = vertex + flipFace;
-  indices[indexOffset + 1] = vertex + flipFace + 1;
-  indices[indexOffset + 2] = vertex + flipFace + 2;
-  indices[indexOffset + 3] = vertex + flipFace + 2;
-  indices[indexOffset + 4] = vertex + ((flipFace + 3) % 4);
-  indices[indexOffset + 5] = vertex + flipFace;
-  growBox(box, x1, y1, z1);
-  growBox(box, x2, y2, z2);
-  growBox(box, x3, y3, z3);
-  growBox(box, x4, y4, z4);
+  for (unsigned char i = 0; i < 4; i++, vertex += 8) {
+    const unsigned char corner = (i + flipFace) % 4;
+    const unsigned char* position = &positions[corner * 3];
+    vertex[0] = position[0];
+    vertex[1] = position[1];
+    vertex[2] = position[2];
+    vertex[3] = r * (1.0f - ao[corner]);
+    vertex[4] = g * (1.0f - ao[corner]);
+    vertex[5] = b * (1.0f - ao[corner]);
+    vertex[6] = (lighting[corner] >> 8) & 0xFF;
+    vertex[7] = lighting[corner] & 0xFF;
+    growBox(box, position[0], position[1], position[2]);
+  }
 }
 
-const int mesh(
+// Faces (in the order they are meshed): top, bottom, south, north, east, west
+static const int faceNormals[] = {
+  0, 1, 0,
+  0, -1, 0,
+  0, 0, 1,
+  0, 0, -1,
+  1, 0, 0,
+  -1, 0, 0
+};
+
+// Axis (x: 0, y: 1, z: 2) of the normal and of the two directions along the face
+static const unsigned char faceAxes[] = {
+  1, 0, 2,
+  1, 0, 2,
+  2, 0, 1,
+  2, 0, 1,
+  0, 2, 1,
+  0, 2, 1
+};
+
+// Every corner of every face: vertex offset, the two neighbors that share
+// the corner along the face and the one in the diagonal (relative to the voxel)
+static const int faceCorners[] = {
+  // top
+  0, 1, 1,  -1, 1, 0,  0, 1, 1,  -1, 1, 1,
+  1, 1, 1,  1, 1, 0,  0, 1, 1,  1, 1, 1,
+  1, 1, 0,  1, 1, 0,  0, 1, -1,  1, 1, -1,
+  0, 1, 0,  -1, 1, 0,  0, 1, -1,  -1, 1, -1,
+  // bottom
+  0, 0, 0,  -1, -1, 0,  0, -1, -1,  -1, -1, -1,
+  1, 0, 0,  1, -1, 0,  0, -1, -1,  1, -1, -1,
+  1, 0, 1,  1, -1, 0,  0, -1, 1,  1, -1, 1,
+  0, 0, 1,  -1, -1, 0,  0, -1, 1,  -1, -1, 1,
+  // south
+  0, 0, 1,  -1, 0, 1,  0, -1, 1,  -1, -1, 1,
+  1, 0, 1,  1, 0, 1,  0, -1, 1,  1, -1, 1,
+  1, 1, 1,  1, 0, 1,  0, 1, 1,  1, 1, 1,
+  0, 1, 1,  -1, 0, 1,  0, 1, 1,  -1, 1, 1,
+  // north
+  1, 0, 0,  1, 0, -1,  0, -1, -1,  1, -1, -1,
+  0, 0, 0,  -1, 0, -1,  0, -1, -1,  -1, -1, -1,
+  0, 1, 0,  -1, 0, -1,  0, 1, -1,  -1, 1, -1,
+  1, 1, 0,  1, 0, -1,  0, 1, -1,  1, 1, -1,
+  // east
+  1, 0, 1,  1, 0, 1,  1, -1, 0,  1, -1, 1,
+  1, 0, 0,  1, 0, -1,  1, -1, 0,  1, -1, -1,
+  1, 1, 0,  1, 0, -1,  1, 1, 0,  1, 1, -1,
+  1, 1, 1,  1, 0, 1,  1, 1, 0,  1, 1, 1,
+  // west
+  0, 0, 0,  -1, 0, -1,  -1, -1, 0,  -1, -1, -1,
+  0, 0, 1,  -1, 0, 1,  -1, -1, 0,  -1, -1, 1,
+  0, 1, 1,  -1, 0, 1,  -1, 1, 0,  -1, 1, 1,
+  0, 1, 0,  -1, 0, -1,  -1, 1, 0,  -1, 1, -1
+};
+
+// Level of detail: Every cell is a scale^3 block of voxels. It's air if at least minAir of them
+// are (the mesher only tells air from solid), with the average color of the solid ones
+// (unless color is NULL) and the average light of the air ones.
+static void gatherDownsampledCell(
+  const World* world,
+  const Voxels* voxels,
+  unsigned char* cell,
+  unsigned char* color,
+  const int scale,
+  const int minAir,
+  const int x,
+  const int y,
+  const int z
+) {
+  // Chunks are multiples of the scale, so cells are either all in or all out of the world
+  if (getVoxel(world, x, y, z) == -1) {
+    cell[NEIGHBORHOOD_TYPE] = outsideType;
+    cell[NEIGHBORHOOD_LIGHT] = 0;
+    cell[NEIGHBORHOOD_SUNLIGHT] = 0;
+    return;
+  }
+  unsigned char type = TYPE_AIR;
+  int air = 0, solid = 0, light = 0, sunlight = 0, r = 0, g = 0, b = 0;
+  for (int vz = z; vz < z + scale; vz++) {
+    for (int vy = y; vy < y + scale; vy++) {
+      for (int vx = x; vx < x + scale; vx++) {
+        const int voxel = getVoxel(world, vx, vy, vz);
+        if (voxels->types[voxel] == TYPE_AIR) {
+          light += voxels->light[voxel * LIGHT_STRIDE + VOXEL_LIGHT];
+          sunlight += voxels->light[voxel * LIGHT_STRIDE + VOXEL_SUNLIGHT];
+          air++;
+        } else {
+          type = voxels->types[voxel];
+          if (color != NULL) {
+            r += voxels->colors[voxel * COLORS_STRIDE + VOXEL_R];
+            g += voxels->colors[voxel * COLORS_STRIDE + VOXEL_G];
+            b += voxels->colors[voxel * COLORS_STRIDE + VOXEL_B];
+          }
+          solid++;
+        }
+      }
+    }
+  }
+  cell[NEIGHBORHOOD_TYPE] = air >= minAir ? TYPE_AIR : type;
+  cell[NEIGHBORHOOD_LIGHT] = air ? light / air : 0;
+  cell[NEIGHBORHOOD_SUNLIGHT] = air ? sunlight / air : 0;
+  if (color != NULL) {
+    color[VOXEL_R] = solid ? r / solid : 0;
+    color[VOXEL_G] = solid ? g / solid : 0;
+    color[VOXEL_B] = solid ? b / solid : 0;
+  }
+}
+
+// Lays out the neighborhood of a chunk in the scratch buffer (without gathering any cell)
+static void initNeighborhood(
+  unsigned char* buffer,
+  Neighborhood* neighborhood,
+  const unsigned char chunkSize,
+  const unsigned char lod,
+  const int chunkX,
+  const int chunkY,
+  const int chunkZ
+) {
+  const int scale = 1 << lod,
+            size = chunkSize / scale + 2,
+            words = (size + 63) / 64,
+            lattice = size - 1,
+            latticeWords = (lattice + 63) / 64;
+  // The masks, the lighting cache & the flood fill go first to keep them aligned
+  unsigned long long* air = (unsigned long long*) buffer;
+  unsigned long long* reached = air + size * size * words;
+  unsigned long long* pending = reached + size * size * words;
+  unsigned long long* lit = pending + size * size * words;
+  unsigned int* lighting = (unsigned int*) (lit + 2 * 6 * lattice * latticeWords);
+  int* rows = (int*) (lighting + 2 * 6 * lattice * lattice);
+  unsigned char* cells = (unsigned char*) (rows + size * size);
+  neighborhood->cells = cells;
+  neighborhood->colors = lod ? cells + size * size * size * NEIGHBORHOOD_STRIDE : NULL;
+  neighborhood->air = air;
+  neighborhood->words = words;
+  neighborhood->lighting = lighting;
+  neighborhood->lit = lit;
+  neighborhood->latticeWords = latticeWords;
+  neighborhood->reached = reached;
+  neighborhood->pending = pending;
+  neighborhood->rows = rows;
+  neighborhood->size = size;
+  neighborhood->scale = scale;
+  neighborhood->origin[0] = chunkX;
+  neighborhood->origin[1] = chunkY;
+  neighborhood->origin[2] = chunkZ;
+  for (unsigned char face = 0; face < 6; face++) {
+    neighborhood->faces[face] = (
+      (faceNormals[face * 3 + 2] * size + faceNormals[face * 3 + 1]) * size + faceNormals[face * 3]
+    ) * NEIGHBORHOOD_STRIDE;
+    for (unsigned char n = 0; n < 12; n++) {
+      const int* offset = &faceCorners[face * 48 + (n / 3) * 12 + 3 + (n % 3) * 3];
+      neighborhood->corners[face * 12 + n] = (
+        (offset[2] * size + offset[1]) * size + offset[0]
+      ) * NEIGHBORHOOD_STRIDE;
+    }
+  }
+}
+
+// Gathers the cells of the neighborhood from (inclusive) to (exclusive), in neighborhood cells.
+// lightOnly: Only the types & light (relight), without the air masks and the colors.
+static void gatherCells(
+  const World* world,
+  const Voxels* voxels,
+  const Neighborhood* neighborhood,
+  const bool lightOnly,
+  const int* from,
+  const int* to
+) {
+  const int size = neighborhood->size,
+            scale = neighborhood->scale,
+            words = neighborhood->words;
+  unsigned char* cells = (unsigned char*) neighborhood->cells;
+  unsigned char* colors = lightOnly ? NULL : (unsigned char*) neighborhood->colors;
+  unsigned long long* air = lightOnly ? NULL : (unsigned long long*) neighborhood->air;
+  // Downsampled cells are air when most of their voxels are. Except around the sides of the chunk,
+  // where the neighbor chunks can be meshed at another lod: There, the cells of the chunk are solid
+  // if any of their voxels is, and the cells past its sides are air if any of their voxels is.
+  // So the chunk draws a face on its sides wherever any of the two could be air, which covers
+  // the gaps between its faces and the ones of its neighbors (like a skirt).
+  const int volume = scale * scale * scale;
+  for (int z = from[2]; z < to[2]; z++) {
+    const int wz = neighborhood->origin[2] + (z - 1) * scale;
+    for (int y = from[1]; y < to[1]; y++) {
+      const int wy = neighborhood->origin[1] + (y - 1) * scale,
+                row = (z * size + y) * words;
+      if (air != NULL) {
+        for (int w = 0; w < words; w++) {
+          air[row + w] = 0;
+        }
+      }
+      for (
+        int x = from[0], i = ((z * size + y) * size + x) * NEIGHBORHOOD_STRIDE, voxel = -1;
+        x < to[0];
+        x++, i += NEIGHBORHOOD_STRIDE
+      ) {
+        const int wx = neighborhood->origin[0] + (x - 1) * scale;
+        if (scale > 1) {
+          const int border = fmin(fmin(fmin(x, size - 1 - x), fmin(y, size - 1 - y)), fmin(z, size - 1 - z));
+          gatherDownsampledCell(
+            world, voxels, &cells[i], colors != NULL ? &colors[i / NEIGHBORHOOD_STRIDE * COLORS_STRIDE] : NULL, scale,
+            border == 0 ? 1 : (border == 1 ? volume : volume / 2 + 1),
+            wx, wy, wz
+          );
+        } else {
+          // The voxels of a row are contiguous (until the next brick in the bricked layout)
+          if (voxel != -1 && wx < world->width && (wx & (world->brickSize - 1)) != 0) {
+            voxel++;
+          } else {
+            voxel = getVoxel(world, wx, wy, wz);
+          }
+          if (voxel == -1) {
+            cells[i + NEIGHBORHOOD_TYPE] = outsideType;
+            cells[i + NEIGHBORHOOD_LIGHT] = 0;
+            cells[i + NEIGHBORHOOD_SUNLIGHT] = 0;
+          } else {
+            cells[i + NEIGHBORHOOD_TYPE] = voxels->types[voxel];
+            cells[i + NEIGHBORHOOD_LIGHT] = voxels->light[voxel * LIGHT_STRIDE + VOXEL_LIGHT];
+            cells[i + NEIGHBORHOOD_SUNLIGHT] = voxels->light[voxel * LIGHT_STRIDE + VOXEL_SUNLIGHT];
+          }
+        }
+        if (air != NULL && cells[i + NEIGHBORHOOD_TYPE] == TYPE_AIR) {
+          air[row + x / 64] |= 1ULL << (x % 64);
+        }
+      }
+    }
+  }
+}
+
+static void gatherNeighborhood(
+  const World* world,
+  const Voxels* voxels,
+  unsigned char* buffer,
+  Neighborhood* neighborhood,
+  const unsigned char chunkSize,
+  const unsigned char lod,
+  const int chunkX,
+  const int chunkY,
+  const int chunkZ
+) {
+  initNeighborhood(buffer, neighborhood, chunkSize, lod, chunkX, chunkY, chunkZ);
+  const int size = neighborhood->size;
+  const int from[3] = { 0, 0, 0 };
+  const int to[3] = { size, size, size };
+  gatherCells(world, voxels, neighborhood, false, from, to);
+}
+
+// Offset of a chunk voxel in the neighborhood
+static const int getNeighborhoodCell(
+  const Neighborhood* neighborhood,
+  const int x,
+  const int y,
+  const int z
+) {
+  const int size = neighborhood->size;
+  return (((z + 1) * size + (y + 1)) * size + (x + 1)) * NEIGHBORHOOD_STRIDE;
+}
+
+// Color of a chunk cell (x, y & z in cells)
+static const unsigned char* getCellColor(
+  const World* world,
+  const Voxels* voxels,
+  const Neighborhood* neighborhood,
+  const int cell,
+  const int x,
+  const int y,
+  const int z
+) {
+  if (neighborhood->colors != NULL) {
+    return &neighborhood->colors[cell / NEIGHBORHOOD_STRIDE * COLORS_STRIDE];
+  }
+  return &voxels->colors[
+    getVoxel(world, neighborhood->origin[0] + x, neighborhood->origin[1] + y, neighborhood->origin[2] + z)
+    * COLORS_STRIDE
+  ];
+}
+
+static void getFaceLighting(
+  const Neighborhood* neighborhood,
+  const unsigned char face,
+  const int cell,
+  unsigned int* lighting
+) {
+  const unsigned char* voxel = &neighborhood->cells[cell];
+  const unsigned char* neighbor = voxel + neighborhood->faces[face];
+  const unsigned char light = neighbor[NEIGHBORHOOD_LIGHT];
+  const unsigned char sunlight = neighbor[NEIGHBORHOOD_SUNLIGHT];
+  const int* corner = &neighborhood->corners[face * 12];
+  for (unsigned char c = 0; c < 4; c++, corner += 3) {
+    lighting[c] = getLighting(
+      light,
+      sunlight,
+      voxel + corner[0],
+      voxel + corner[1],
+      voxel + corner[2]
+    );
+  }
+}
+
+// Empties the plane of the lighting cache of the corners at z
+static void clearLightingPlane(
+  const Neighborhood* neighborhood,
+  const int z
+) {
+  const int bits = 6 * (neighborhood->size - 1) * neighborhood->latticeWords;
+  unsigned long long* lit = &neighborhood->lit[(z & 1) * bits];
+  for (int i = 0; i < bits; i++) {
+    lit[i] = 0;
+  }
+}
+
+// Same as getFaceLighting but through the lighting cache (x, y & z in chunk cells).
+// Any two air cells around a corner that are connected get the same lighting from it,
+// so it can be shared by all the faces of the same direction.
+static void getCachedFaceLighting(
+  const Neighborhood* neighborhood,
+  const unsigned char face,
+  const int cell,
+  const int x,
+  const int y,
+  const int z,
+  unsigned int* lighting
+) {
+  const int lattice = neighborhood->size - 1,
+            words = neighborhood->latticeWords;
+  const unsigned char* voxel = &neighborhood->cells[cell];
+  const unsigned char* neighbor = voxel + neighborhood->faces[face];
+  const int* corner = &neighborhood->corners[face * 12];
+  const int* vertex = &faceCorners[face * 48];
+  for (unsigned char c = 0; c < 4; c++, corner += 3, vertex += 12) {
+    const int cx = x + vertex[0],
+              row = (((z + vertex[2]) & 1) * 6 + face) * lattice + y + vertex[1];
+    unsigned long long* lit = &neighborhood->lit[row * words + cx / 64];
+    const unsigned long long bit = 1ULL << (cx % 64);
+    unsigned int* cached = &neighborhood->lighting[row * lattice + cx];
+    COUNT(reads, 1);
+    if (*lit & bit) {
+      COUNT(reads, 1);
+      lighting[c] = *cached;
+      continue;
+    }
+    const unsigned char* n1 = voxel + corner[0];
+    const unsigned char* n2 = voxel + corner[1];
+    const unsigned char* n3 = voxel + corner[2];
+    lighting[c] = getLighting(
+      neighbor[NEIGHBORHOOD_LIGHT],
+      neighbor[NEIGHBORHOOD_SUNLIGHT],
+      n1,
+      n2,
+      n3
+    );
+    // Unless the diagonal is the only other air cell (the faces on each side of it don't share the light)
+    if (
+      n1[NEIGHBORHOOD_TYPE] == TYPE_AIR
+      || n2[NEIGHBORHOOD_TYPE] == TYPE_AIR
+      || n3[NEIGHBORHOOD_TYPE] != TYPE_AIR
+    ) {
+      *cached = lighting[c];
+      *lit |= bit;
+    }
+  }
+}
+
+static const bool getFace(
+  const Neighborhood* neighborhood,
+  const unsigned char face,
+  const int cell,
+  unsigned int* lighting
+) {
+  if (neighborhood->cells[cell + neighborhood->faces[face] + NEIGHBORHOOD_TYPE] != TYPE_AIR) {
+    return false;
+  }
+  getFaceLighting(neighborhood, face, cell, lighting);
+  return true;
+}
+
+// Bits of the chunk cells in a word of a row (the first & last cells of the row are the padding)
+static const unsigned long long getInsideMask(
+  const Neighborhood* neighborhood,
+  const int word
+) {
+  const int size = neighborhood->size;
+  unsigned long long inside = ~0ULL;
+  if (word == 0) inside &= ~1ULL;
+  if ((word + 1) * 64 > size - 1) inside &= (1ULL << ((size - 1) % 64)) - 1;
+  return inside;
+}
+
+// Exposed faces of a word of a row of the chunk (y & z in neighborhood coordinates)
+static void getFaceMasks(
+  const Neighborhood* neighborhood,
+  const int y,
+  const int z,
+  const int word,
+  unsigned long long* masks
+) {
+  const int size = neighborhood->size,
+            words = neighborhood->words;
+  const unsigned long long inside = getInsideMask(neighborhood, word);
+  const unsigned long long* row = &neighborhood->air[(z * size + y) * words];
+  const unsigned long long solid = ~row[word] & inside;
+  masks[0] = solid & row[words + word];
+  masks[1] = solid & row[-words + word];
+  masks[2] = solid & row[size * words + word];
+  masks[3] = solid & row[-size * words + word];
+  masks[4] = solid & ((row[word] >> 1) | (word + 1 < words ? row[word + 1] << 63 : 0));
+  masks[5] = solid & ((row[word] << 1) | (word > 0 ? row[word - 1] >> 63 : 0));
+}
+
+// Spreads the bits through the contiguous bits of air (in log steps, both ways)
+static const unsigned long long spreadBits(
+  const unsigned long long bits,
+  const unsigned long long air
+) {
+  unsigned long long up = bits, down = bits, upAir = air, downAir = air;
+  for (int shift = 1; shift < 64; shift *= 2) {
+    up |= upAir & (up << shift);
+    upAir &= upAir << shift;
+    down |= downAir & (down >> shift);
+    downAir &= downAir >> shift;
+  }
+  return up | down;
+}
+
+// Connects every pair of the sides (bit (a * 6 + b) for every pair a < b)
+static const int connectSides(
+  int connections,
+  const unsigned char sides
+) {
+  for (unsigned char a = 0; a < 6; a++) {
+    for (unsigned char b = a + 1; b < 6; b++) {
+      if ((sides >> a) & (sides >> b) & 1) {
+        connections |= 1 << (a * 6 + b);
+      }
+    }
+  }
+  return connections;
+}
+
+// Pairs of chunk sides (top, bottom, south, north, east, west) that are connected
+// through the air inside the chunk: bit (a * 6 + b) for every connected pair a < b.
+// It flood fills every air region, a whole row at a time, and collects the sides it touches.
+static const int getConnections(
+  const Neighborhood* neighborhood
+) {
+  const int size = neighborhood->size,
+            words = neighborhood->words,
+            cells = size - 2;
+  const unsigned long long* air = neighborhood->air;
+  unsigned long long* reached = neighborhood->reached;
+  unsigned long long* pending = neighborhood->pending;
+  int* rows = neighborhood->rows;
+  unsigned long long inside[words], bits[words];
+  for (int w = 0; w < words; w++) {
+    inside[w] = getInsideMask(neighborhood, w);
+  }
+  // Chunks that are all air (like the sky) connect all their sides
+  bool isEmpty = true;
+  for (int z = 1; z <= cells && isEmpty; z++) {
+    for (int y = 1; y <= cells && isEmpty; y++) {
+      for (int w = 0; w < words; w++) {
+        if ((air[(z * size + y) * words + w] & inside[w]) != inside[w]) {
+          isEmpty = false;
+          break;
+        }
+      }
+    }
+  }
+  if (isEmpty) {
+    return connectSides(0, 0x3F);
+  }
+  int connections = 0;
+  for (int i = 0; i < size * size * words; i++) {
+    reached[i] = pending[i] = 0;
+  }
+  for (int z = 1; z <= cells; z++) {
+    for (int y = 1; y <= cells; y++) {
+      const int row = z * size + y;
+      for (int word = 0; word < words; word++) {
+        unsigned long long unreached;
+        while ((unreached = air[row * words + word] & inside[word] & ~reached[row * words + word])) {
+          // Every row is at most once in the stack (while it has pending bits)
+          pending[row * words + word] = unreached & -unreached;
+          rows[0] = row;
+          int count = 1;
+          unsigned char sides = 0;
+          while (count) {
+            const int current = rows[--count],
+                      cz = current / size,
+                      cy = current - cz * size;
+            for (int w = 0; w < words; w++) {
+              bits[w] = pending[current * words + w];
+              pending[current * words + w] = 0;
+            }
+            // Spreads along the row, carrying across the words
+            for (bool changed = true; changed; changed = changed && words > 1) {
+              changed = false;
+              for (int w = 0; w < words; w++) {
+                const unsigned long long open = air[current * words + w] & inside[w];
+                unsigned long long spread = bits[w];
+                if (w > 0 && (bits[w - 1] >> 63)) spread |= open & 1ULL;
+                if (w + 1 < words && (bits[w + 1] & 1ULL)) spread |= open & (1ULL << 63);
+                spread = spreadBits(spread, open);
+                if (spread != bits[w]) {
+                  bits[w] = spread;
+                  changed = true;
+                }
+              }
+            }
+            for (int w = 0; w < words; w++) {
+              reached[current * words + w] |= bits[w];
+            }
+            if (cy == cells) sides |= 1 << 0;
+            if (cy == 1) sides |= 1 << 1;
+            if (cz == cells) sides |= 1 << 2;
+            if (cz == 1) sides |= 1 << 3;
+            if ((bits[cells / 64] >> (cells % 64)) & 1) sides |= 1 << 4;
+            if (bits[0] & 2ULL) sides |= 1 << 5;
+            const int neighbors[] = {
+              cy < cells ? current + 1 : -1,
+              cy > 1 ? current - 1 : -1,
+              cz < cells ? current + size : -1,
+              cz > 1 ? current - size : -1
+            };
+            for (unsigned char n = 0; n < 4; n++) {
+              const int next = neighbors[n];
+              if (next == -1) {
+                continue;
+              }
+              bool wasPending = false, isPending = false;
+              for (int w = 0; w < words; w++) {
+                const int i = next * words + w;
+                wasPending = wasPending || pending[i];
+                pending[i] |= bits[w] & air[i] & ~reached[i];
+                isPending = isPending || pending[i];
+              }
+              if (isPending && !wasPending) {
+                rows[count++] = next;
+              }
+            }
+          }
+          connections = connectSides(connections, sides);
+        }
+      }
+    }
+  }
+  return connections;
+}
+
+// Pushes a face of width by height cells (along the face directions) of scale voxels
+static void pushVoxelFace(
+  unsigned char* box,
+  unsigned int* faces,
+  unsigned char* vertices,
+  const int chunkX, const int chunkY, const int chunkZ,
+  const unsigned char face,
+  const int x, const int y, const int z,
+  const int width, const int height, const int scale,
+  const unsigned char r, const unsigned char g, const unsigned char b,
+  const unsigned int* lighting
+) {
+  int size[3] = { scale, scale, scale };
+  size[faceAxes[face * 3 + 1]] = width * scale;
+  size[faceAxes[face * 3 + 2]] = height * scale;
+  const int* corner = &faceCorners[face * 48];
+  pushFace(
+    box,
+    faces,
+    vertices,
+    chunkX, chunkY, chunkZ,
+    r, g, b,
+    x + corner[0] * size[0], y + corner[1] * size[1], z + corner[2] * size[2], lighting[0],
+    x + corner[12] * size[0], y + corner[13] * size[1], z + corner[14] * size[2], lighting[1],
+    x + corner[24] * size[0], y + corner[25] * size[1], z + corner[26] * size[2], lighting[2],
+    x + corner[36] * size[0], y + corner[37] * size[1], z + corner[38] * size[2], lighting[3]
+  );
+}
+
+static void meshGreedy(
+  const World* world,
+  const Voxels* voxels,
+  const Neighborhood* neighborhood,
+  unsigned char* box,
+  unsigned int* faces,
+  int* directions,
+  unsigned char* vertices,
+  const int chunkX,
+  const int chunkY,
+  const int chunkZ
+) {
+  const int chunkSize = neighborhood->size - 2,
+            scale = neighborhood->scale;
+  // Faces with the same color & light in all their corners (0: none)
+  unsigned long long mask[chunkSize * chunkSize];
+  for (unsigned char face = 0; face < 6; face++) {
+    const unsigned int first = *faces;
+    const unsigned char axis = faceAxes[face * 3],
+                        axisU = faceAxes[face * 3 + 1],
+                        axisV = faceAxes[face * 3 + 2];
+    for (int slice = 0; slice < chunkSize; slice++) {
+      for (int v = 0, i = 0; v < chunkSize; v++) {
+        for (int u = 0; u < chunkSize; u++, i++) {
+          int position[3];
+          position[axis] = slice;
+          position[axisU] = u;
+          position[axisV] = v;
+          mask[i] = 0;
+          const int cell = getNeighborhoodCell(neighborhood, position[0], position[1], position[2]);
+          unsigned int lighting[4];
+          if (
+            neighborhood->cells[cell + NEIGHBORHOOD_TYPE] == TYPE_AIR
+            || !getFace(neighborhood, face, cell, lighting)
+          ) {
+            continue;
+          }
+          const unsigned char* color = getCellColor(
+            world, voxels, neighborhood, cell, position[0], position[1], position[2]
+          );
+          const unsigned char r = color[VOXEL_R],
+                              g = color[VOXEL_G],
+                              b = color[VOXEL_B];
+          if (lighting[0] == lighting[1] && lighting[0] == lighting[2] && lighting[0] == lighting[3]) {
+            mask[i] = (1ULL << 48) | ((unsigned long long) ((r << 16) | (g << 8) | b) << 24) | lighting[0];
+            continue;
+          }
+          // The light gets interpolated across the face, so these can't be merged
+          pushVoxelFace(
+            box, faces, vertices,
+            chunkX, chunkY, chunkZ,
+            face,
+            chunkX + position[0] * scale, chunkY + position[1] * scale, chunkZ + position[2] * scale,
+            1, 1, scale,
+            r, g, b,
+            lighting
+          );
+        }
+      }
+      for (int v = 0, i = 0; v < chunkSize; v++) {
+        for (int u = 0; u < chunkSize; u++, i++) {
+          const unsigned long long key = mask[i];
+          if (key == 0) {
+            continue;
+          }
+          int width = 1, height = 1;
+          while (u + width < chunkSize && mask[i + width] == key) {
+            width++;
+          }
+          for (bool grow = true; grow && v + height < chunkSize; height += grow ? 1 : 0) {
+            for (int w = 0; w < width; w++) {
+              if (mask[i + height * chunkSize + w] != key) {
+                grow = false;
+                break;
+              }
+            }
+          }
+          for (int h = 0; h < height; h++) {
+            for (int w = 0; w < width; w++) {
+              mask[i + h * chunkSize + w] = 0;
+            }
+          }
+          int position[3];
+          position[axis] = slice;
+          position[axisU] = u;
+          position[axisV] = v;
+          const unsigned int lighting[4] = {
+            key & 0xFFFFFF, key & 0xFFFFFF, key & 0xFFFFFF, key & 0xFFFFFF,
+          };
+          pushVoxelFace(
+            box, faces, vertices,
+            chunkX, chunkY, chunkZ,
+            face,
+            chunkX + position[0] * scale, chunkY + position[1] * scale, chunkZ + position[2] * scale,
+            width, height, scale,
+            (key >> 40) & 0xFF, (key >> 32) & 0xFF, (key >> 24) & 0xFF,
+            lighting
+          );
+        }
+      }
+    }
+    directions[face] = *faces - first;
+  }
+}
+
+static const int meshChunk(
   const World* world,
-  const unsigned char* voxels,
+  const Voxels* voxels,
   float* bounds,
-  unsigned int* indices,
+  int* directions,
+  int* connections,
   unsigned char* vertices,
+  unsigned char* neighbors,
   const unsigned char chunkSize,
+  const bool greedy,
+  const unsigned char lod,
   const int chunkX,
   const int chunkY,
   const int chunkZ
@@ -160,171 +858,79 @@ const int mesh(
     || chunkX + chunkSize > world->width
     || chunkY + chunkSize > world->height
     || chunkZ + chunkSize > world->depth
+    || lod > maxLOD
+    || chunkSize % (1 << lod) != 0
   ) {
     return -1;
   }
   // WELCOME TO THE JUNGLE !!
   unsigned char box[6] = { chunkSize, chunkSize, chunkSize, 0, 0, 0 };
   unsigned int faces = 0;
-  for (int z = chunkZ; z < chunkZ + chunkSize; z++) {
-    for (int y = chunkY; y < chunkY + chunkSize; y++) {
-      for (int x = chunkX; x < chunkX + chunkSize; x++) {
-        const int voxel = getVoxel(world, x, y, z);
-        if (voxels[voxel] == TYPE_AIR) {
-          continue;
-        }
-        const unsigned char r = voxels[voxel + VOXEL_R],
-                            g = voxels[voxel + VOXEL_G],
-                            b = voxels[voxel + VOXEL_B];
-        const int top = getVoxel(world, x, y + 1, z),
-                  bottom = getVoxel(world, x, y - 1, z),
-                  south = getVoxel(world, x, y, z + 1),
-                  north = getVoxel(world, x, y, z - 1),
-                  east = getVoxel(world, x + 1, y, z),
-                  west = getVoxel(world, x - 1, y, z);
-        if (top != -1 && voxels[top] == TYPE_AIR) {
-          const unsigned char light = voxels[top + VOXEL_LIGHT];
-          const unsigned char sunlight = voxels[top + VOXEL_SUNLIGHT];
-          const int ts = getVoxel(world, x, y + 1, z + 1),
-                    tn = getVoxel(world, x, y + 1, z - 1),
-                    te = getVoxel(world, x + 1, y + 1, z),
-                    tw = getVoxel(world, x - 1, y + 1, z);
-          pushFace(
-            box,
-            &faces,
-            indices,
-            vertices,
-            chunkX, chunkY, chunkZ,
-            r, g, b,
-            x, y + 1, z + 1,
-            getLighting(voxels, light, sunlight, tw, ts, getVoxel(world, x - 1, y + 1, z + 1)),
-            x + 1, y + 1, z + 1,
-            getLighting(voxels, light, sunlight, te, ts, getVoxel(world, x + 1, y + 1, z + 1)),
-            x + 1, y + 1, z,
-            getLighting(voxels, light, sunlight, te, tn, getVoxel(world, x + 1, y + 1, z - 1)),
-            x, y + 1, z,
-            getLighting(voxels, light, sunlight, tw, tn, getVoxel(world, x - 1, y + 1, z - 1))
-          );
-        }
-        if (bottom != -1 && voxels[bottom] == TYPE_AIR) {
-          const unsigned char light = voxels[bottom + VOXEL_LIGHT];
-          const unsigned char sunlight = voxels[bottom + VOXEL_SUNLIGHT];
-          const int bs = getVoxel(world, x, y - 1, z + 1),
-                    bn = getVoxel(world, x, y - 1, z - 1),
-                    be = getVoxel(world, x + 1, y - 1, z),
-                    bw = getVoxel(world, x - 1, y - 1, z);
-          pushFace(
-            box,
-            &faces,
-            indices,
-            vertices,
-            chunkX, chunkY, chunkZ,
-            r, g, b,
-            x, y, z,
-            getLighting(voxels, light, sunlight, bw, bn, getVoxel(world, x - 1, y - 1, z - 1)),
-            x + 1, y, z,
-            getLighting(voxels, light, sunlight, be, bn, getVoxel(world, x + 1, y - 1, z - 1)),
-            x + 1, y, z + 1,
-            getLighting(voxels, light, sunlight, be, bs, getVoxel(world, x + 1, y - 1, z + 1)),
-            x, y, z + 1,
-            getLighting(voxels, light, sunlight, bw, bs, getVoxel(world, x - 1, y - 1, z + 1))
-          );
-        }
-        if (south != -1 && voxels[south] == TYPE_AIR) {
-          const unsigned char light = voxels[south + VOXEL_LIGHT];
-          const unsigned char sunlight = voxels[south + VOXEL_SUNLIGHT];
-          const int st = getVoxel(world, x, y + 1, z + 1),
-                    sb = getVoxel(world, x, y - 1, z + 1),
-                    se = getVoxel(world, x + 1, y, z + 1),
-                    sw = getVoxel(world, x - 1, y, z + 1);
-          pushFace(
-            box,
-            &faces,
-            indices,
-            vertices,
-            chunkX, chunkY, chunkZ,
-            r, g, b,
-            x, y, z + 1,
-            getLighting(voxels, light, sunlight, sw, sb, getVoxel(world, x - 1, y - 1, z + 1)),
-            x + 1, y, z + 1,
-            getLighting(voxels, light, sunlight, se, sb, getVoxel(world, x + 1, y - 1, z + 1)),
-            x + 1, y + 1, z + 1,
-            getLighting(voxels, light, sunlight, se, st, getVoxel(world, x + 1, y + 1, z + 1)),
-            x, y + 1, z + 1,
-            getLighting(voxels, light, sunlight, sw, st, getVoxel(world, x - 1, y + 1, z + 1))
-          );
-        }
-        if (north != -1 && voxels[north] == TYPE_AIR) {
-          const unsigned char light = voxels[north + VOXEL_LIGHT];
-          const unsigned char sunlight = voxels[north + VOXEL_SUNLIGHT];
-          const int nt = getVoxel(world, x, y + 1, z - 1),
-                    nb = getVoxel(world, x, y - 1, z - 1),
-                    ne = getVoxel(world, x + 1, y, z - 1),
-                    nw = getVoxel(world, x - 1, y, z - 1);
-          pushFace(
-            box,
-            &faces,
-            indices,
-            vertices,
-            chunkX, chunkY, chunkZ,
-            r, g, b,
-            x + 1, y, z,
-            getLighting(voxels, light, sunlight, ne, nb, getVoxel(world, x + 1, y - 1, z - 1)),
-            x, y, z,
-            getLighting(voxels, light, sunlight, nw, nb, getVoxel(world, x - 1, y - 1, z - 1)),
-            x, y + 1, z,
-            getLighting(voxels, light, sunlight, nw, nt, getVoxel(world, x - 1, y + 1, z - 1)),
-            x + 1, y + 1, z,
-            getLighting(voxels, light, sunlight, ne, nt, getVoxel(world, x + 1, y + 1, z - 1))
-          );
-        }
-        if (east != -1 && voxels[east] == TYPE_AIR) {
-          const unsigned char light = voxels[east + VOXEL_LIGHT];
-          const unsigned char sunlight = voxels[east + VOXEL_SUNLIGHT];
-          const int et = getVoxel(world, x + 1, y + 1, z),
-                    eb = getVoxel(world, x + 1, y - 1, z),
-                    es = getVoxel(world, x + 1, y, z + 1),
-                    en = getVoxel(world, x + 1, y, z - 1);
-          pushFace(
-            box,
-            &faces,
-            indices,
-            vertices,
-            chunkX, chunkY, chunkZ,
-            r, g, b,
-            x + 1, y, z + 1,
-            getLighting(voxels, light, sunlight, es, eb, getVoxel(world, x + 1, y - 1, z + 1)),
-            x + 1, y, z,
-            getLighting(voxels, light, sunlight, en, eb, getVoxel(world, x + 1, y - 1, z - 1)),
-            x + 1, y + 1, z,
-            getLighting(voxels, light, sunlight, en, et, getVoxel(world, x + 1, y + 1, z - 1)),
-            x + 1, y + 1, z + 1,
-            getLighting(voxels, light, sunlight, es, et, getVoxel(world, x + 1, y + 1, z + 1))
-          );
+  Neighborhood neighborhood;
+  gatherNeighborhood(world, voxels, neighbors, &neighborhood, chunkSize, lod, chunkX, chunkY, chunkZ);
+  const int cells = neighborhood.size - 2,
+            scale = neighborhood.scale;
+  *connections = getConnections(&neighborhood);
+  if (greedy) {
+    meshGreedy(world, voxels, &neighborhood, box, &faces, directions, vertices, chunkX, chunkY, chunkZ);
+  } else {
+    unsigned long long masks[6];
+    // Counts the faces of every direction first, so they can be pushed grouped by direction
+    for (unsigned char face = 0; face < 6; face++) {
+      directions[face] = 0;
+    }
+    for (int z = 1; z <= cells; z++) {
+      for (int y = 1; y <= cells; y++) {
+        for (int word = 0; word < neighborhood.words; word++) {
+          getFaceMasks(&neighborhood, y, z, word, masks);
+          for (unsigned char face = 0; face < 6; face++) {
+            directions[face] += __builtin_popcountll(masks[face]);
+          }
         }
-        if (west != -1 && voxels[west] == TYPE_AIR) {
-          const unsigned char light = voxels[west + VOXEL_LIGHT];
-          const unsigned char sunlight = voxels[west + VOXEL_SUNLIGHT];
-          const int wt = getVoxel(world, x - 1, y + 1, z),
-                    wb = getVoxel(world, x - 1, y - 1, z),
-                    ws = getVoxel(world, x - 1, y, z + 1),
-                    wn = getVoxel(world, x - 1, y, z - 1);
-          pushFace(
-            box,
-            &faces,
-            indices,
-            vertices,
-            chunkX, chunkY, chunkZ,
-            r, g, b,
-            x, y, z,
-            getLighting(voxels, light, sunlight, wn, wb, getVoxel(world, x - 1, y - 1, z - 1)),
-            x, y, z + 1,
-            getLighting(voxels, light, sunlight, ws, wb, getVoxel(world, x - 1, y - 1, z + 1)),
-            x, y + 1, z + 1,
-            getLighting(voxels, light, sunlight, ws, wt, getVoxel(world, x - 1, y + 1, z + 1)),
-            x, y + 1, z,
-            getLighting(voxels, light, sunlight, wn, wt, getVoxel(world, x - 1, y + 1, z - 1))
-          );
+      }
+    }
+    unsigned int offsets[6];
+    for (unsigned char face = 0; face < 6; face++) {
+      offsets[face] = faces;
+      faces += directions[face];
+    }
+    // Only the cells with exposed faces get their AO & light computed
+    for (int z = 1; z <= cells; z++) {
+      // The cells of this slice have their corners at z - 1 (cached by the previous slice) & z
+      if (z == 1) {
+        clearLightingPlane(&neighborhood, 0);
+      }
+      clearLightingPlane(&neighborhood, z);
+      for (int y = 1; y <= cells; y++) {
+        for (int word = 0; word < neighborhood.words; word++) {
+          getFaceMasks(&neighborhood, y, z, word, masks);
+          unsigned long long exposed = masks[0] | masks[1] | masks[2] | masks[3] | masks[4] | masks[5];
+          while (exposed) {
+            const int bit = __builtin_ctzll(exposed),
+                      x = word * 64 + bit - 1;
+            exposed &= exposed - 1;
+            const int cell = getNeighborhoodCell(&neighborhood, x, y - 1, z - 1);
+            const unsigned char* color = getCellColor(world, voxels, &neighborhood, cell, x, y - 1, z - 1);
+            const unsigned char r = color[VOXEL_R],
+                                g = color[VOXEL_G],
+                                b = color[VOXEL_B];
+            for (unsigned char face = 0; face < 6; face++) {
+              if (!((masks[face] >> bit) & 1)) {
+                continue;
+              }
+              unsigned int lighting[4];
+              getCachedFaceLighting(&neighborhood, face, cell, x, y - 1, z - 1, lighting);
+              pushVoxelFace(
+                box, &offsets[face], vertices,
+                chunkX, chunkY, chunkZ,
+                face,
+                chunkX + x * scale, chunkY + (y - 1) * scale, chunkZ + (z - 1) * scale,
+                1, 1, scale,
+                r, g, b,
+                lighting
+              );
+            }
+          }
         }
       }
     }
@@ -344,3 +950,204 @@ const int mesh(
 
   return faces;
 }
+
+// Full detail (their cells are the voxels) bitmask meshes of the chunk sizes in CHUNK_KERNEL_SIZES.
+// The greedy mesher doesn't gain anything from it, so it only has the generic copy.
+#define MESH_KERNEL(size) \
+  FLATTEN const int mesh##size( \
+    const World* world, \
+    const Voxels* voxels, \
+    float* bounds, \
+    int* directions, \
+    int* connections, \
+    unsigned char* vertices, \
+    unsigned char* neighbors, \
+    const int chunkX, \
+    const int chunkY, \
+    const int chunkZ \
+  ) { \
+    return meshChunk( \
+      world, voxels, bounds, directions, connections, vertices, neighbors, \
+      size, false, 0, chunkX, chunkY, chunkZ \
+    ); \
+  }
+CHUNK_KERNEL_SIZES(MESH_KERNEL)
+
+#define MESH_KERNEL_CASE(size) \
+  case size: \
+    return mesh##size(world, voxels, bounds, directions, connections, vertices, neighbors, chunkX, chunkY, chunkZ);
+
+const int mesh(
+  const World* world,
+  const Voxels* voxels,
+  float* bounds,
+  int* directions,
+  int* connections,
+  unsigned char* vertices,
+  unsigned char* neighbors,
+  const unsigned char chunkSize,
+  const bool greedy,
+  const unsigned char lod,
+  const int chunkX,
+  const int chunkY,
+  const int chunkZ
+) {
+  if (!greedy && lod == 0) {
+    switch (chunkSize) {
+      CHUNK_KERNEL_SIZES(MESH_KERNEL_CASE)
+    }
+  }
+  return meshChunk(
+    world, voxels, bounds, directions, connections, vertices, neighbors,
+    chunkSize, greedy, lod, chunkX, chunkY, chunkZ
+  );
+}
+
+const int meshChunks(
+  const World* world,
+  const Voxels* voxels,
+  float* bounds,
+  int* faces,
+  int* directions,
+  int* connections,
+  unsigned char* vertices,
+  unsigned char* neighbors,
+  const int* chunks,
+  const int count,
+  const int capacity,
+  const unsigned char chunkSize,
+  const bool greedy
+) {
+  // Worst possible case (every other voxel is solid)
+  const int maxFaces = (chunkSize * chunkSize * chunkSize + 1) / 2 * 6;
+  int offset = 0;
+  for (int i = 0; i < count; i++) {
+    if (offset + maxFaces > capacity) {
+      return i;
+    }
+    const int chunkFaces = mesh(
+      world,
+      voxels,
+      &bounds[i * 4],
+      &directions[i * 6],
+      &connections[i],
+      &vertices[offset * 4 * 8],
+      neighbors,
+      chunkSize,
+      greedy,
+      chunks[i * 4 + 3],
+      chunks[i * 4],
+      chunks[i * 4 + 1],
+      chunks[i * 4 + 2]
+    );
+    faces[i * 2] = offset;
+    faces[i * 2 + 1] = chunkFaces;
+    if (chunkFaces > 0) {
+      offset += chunkFaces;
+    }
+  }
+  return count;
+}
+
+const int relight(
+  const World* world,
+  const Voxels* voxels,
+  const unsigned char* vertices,
+  unsigned char* light,
+  unsigned char* neighbors,
+  const int faces,
+  const unsigned char chunkSize,
+  const unsigned char lod,
+  const int chunkX,
+  const int chunkY,
+  const int chunkZ
+) {
+  if (
+    chunkX < 0
+    || chunkY < 0
+    || chunkZ < 0
+    || chunkX + chunkSize > world->width
+    || chunkY + chunkSize > world->height
+    || chunkZ + chunkSize > world->depth
+    || lod > maxLOD
+    || chunkSize % (1 << lod) != 0
+  ) {
+    return -1;
+  }
+  Neighborhood neighborhood;
+  initNeighborhood(neighbors, &neighborhood, chunkSize, lod, chunkX, chunkY, chunkZ);
+  const int scale = neighborhood.scale,
+            size = neighborhood.size;
+  // Only gathers the types & light of the cells around the faces
+  // (the box of their vertices, plus the cells on both sides and their neighbors)
+  int from[3] = { 0xFF, 0xFF, 0xFF };
+  int to[3] = { 0, 0, 0 };
+  for (int i = 0; i < faces * 4; i++) {
+    const unsigned char* vertex = &vertices[i * 8];
+    for (unsigned char a = 0; a < 3; a++) {
+      if (from[a] > vertex[a]) from[a] = vertex[a];
+      if (to[a] < vertex[a]) to[a] = vertex[a];
+    }
+  }
+  for (unsigned char a = 0; a < 3; a++) {
+    from[a] = fmax(from[a] / scale - 1, 0);
+    to[a] = fmin(to[a] / scale + 3, size);
+  }
+  gatherCells(world, voxels, &neighborhood, true, from, to);
+  // The faces of every direction come in slices along z (see meshChunk), so they can go through
+  // the lighting cache too. It's cleared whenever the direction changes or a slice is skipped.
+  int lastFace = -1, lastZ = 0;
+  for (int i = 0; i < faces; i++) {
+    const unsigned char* vertex = &vertices[i * 4 * 8];
+    // The quad lies on the plane of the axis its diagonal (vertices 0 & 2) doesn't move along
+    const unsigned char* opposite = &vertex[16];
+    const unsigned char axis = vertex[0] == opposite[0] ? 0 : (vertex[1] == opposite[1] ? 1 : 2),
+                        u = (axis + 1) % 3,
+                        w = (axis + 2) % 3;
+    if (abs(opposite[u] - vertex[u]) != scale || abs(opposite[w] - vertex[w]) != scale) {
+      // Merged faces would need to be split if their light isn't uniform anymore
+      return -1;
+    }
+    // and faces the side its first triangle winds counter-clockwise around
+    const int normal = (vertex[8 + u] - vertex[u]) * (opposite[w] - vertex[w])
+                       - (vertex[8 + w] - vertex[w]) * (opposite[u] - vertex[u]);
+    const unsigned char face = (axis == 1 ? 0 : (axis == 2 ? 2 : 4)) + (normal < 0 ? 1 : 0);
+    // The cell is the one on the back side of the quad
+    int position[3];
+    position[axis] = vertex[axis] / scale - (normal > 0 ? 1 : 0);
+    position[u] = fmin(vertex[u], opposite[u]) / scale;
+    position[w] = fmin(vertex[w], opposite[w]) / scale;
+    if (face != lastFace || position[2] < lastZ || position[2] > lastZ + 1) {
+      clearLightingPlane(&neighborhood, position[2]);
+    }
+    if (face != lastFace || position[2] != lastZ) {
+      clearLightingPlane(&neighborhood, position[2] + 1);
+    }
+    lastFace = face;
+    lastZ = position[2];
+    unsigned int lighting[4];
+    getCachedFaceLighting(
+      &neighborhood,
+      face,
+      getNeighborhoodCell(&neighborhood, position[0], position[1], position[2]),
+      position[0],
+      position[1],
+      position[2],
+      lighting
+    );
+    // Vertices are rotated by one to flip the quad (see pushFace)
+    const int* corners = &faceCorners[face * 48];
+    const unsigned char flipFace = (
+      vertex[0] != (position[0] + corners[0]) * scale
+      || vertex[1] != (position[1] + corners[1]) * scale
+      || vertex[2] != (position[2] + corners[2]) * scale
+    ) ? 1 : 0;
+    unsigned char* output = &light[i * 4 * LIGHT_STRIDE];
+    for (unsigned char v = 0; v < 4; v++, output += LIGHT_STRIDE) {
+      const unsigned char corner = (v + flipFace) % 4;
+      output[VOXEL_LIGHT] = (lighting[corner] >> 8) & 0xFF;
+      output[VOXEL_SUNLIGHT] = lighting[corner] & 0xFF;
+    }
+  }
+  return faces;
+}
@@ -8,11 +8,24 @@ typedef struct {
 
 typedef struct {
   const World* world;
-  const unsigned char* voxels;
+  const Voxels* voxels;
   const unsigned char* obstacles;
   const int height;
 } PathContext;
 
+// The obstacles map is always in the linear layout (it's filled from JS)
+static const bool isObstacle(
+  const World* world,
+  const unsigned char* obstacles,
+  const int x,
+  const int y,
+  const int z
+) {
+  // One bit per voxel
+  const int index = z * world->width * world->height + y * world->width + x;
+  return obstacles[index >> 3] & (1 << (index & 7));
+}
+
 static const bool canWalk(
   const PathContext* context,
   const int x,
@@ -23,15 +36,15 @@ static const bool canWalk(
     return false;
   }
   const int voxel = getVoxel(context->world, x, y, z);
-  if (voxel == -1 || context->voxels[voxel] == TYPE_AIR) {
+  if (voxel == -1 || context->voxels->types[voxel] == TYPE_AIR) {
     return false;
   }
   for (int h = 1; h <= context->height; h++) {
     const int voxel = getVoxel(context->world, x, y + h, z);
     if (
       voxel == -1
-      || context->voxels[voxel] != TYPE_AIR
-      || context->obstacles[voxel / VOXELS_STRIDE]
+      || context->voxels->types[voxel] != TYPE_AIR
+      || isObstacle(context->world, context->obstacles, x, y + h, z)
     ) {
       return false;
     }
@@ -100,7 +113,7 @@ static const ASPathNodeSource PathNodeSource = {
 const int findGround(
   const World* world,
   const int* heightmap,
-  const unsigned char* voxels,
+  const Voxels* voxels,
   const bool avoidTrees,
   const int height,
   const int x,
@@ -108,14 +121,14 @@ const int findGround(
   const int z
 ) {
   for (; y >= world->seaLevel; y--) {
-    const unsigned char type = voxels[getVoxel(world, x, y, z)];
+    const unsigned char type = voxels->types[getVoxel(world, x, y, z)];
     if (type == TYPE_AIR || (avoidTrees && type == TYPE_TREE)) {
       continue;
     }
     bool isValid = true;
     for (int h = 1; h <= height; h++) {
       const int voxel = getVoxel(world, x, y + h, z);
-      if (voxels[voxel] != TYPE_AIR) {
+      if (voxels->types[voxel] != TYPE_AIR) {
         isValid = false;
         break;
       }
@@ -129,7 +142,7 @@ const int findGround(
 
 const int findPath(
   const World* world,
-  const unsigned char* voxels,
+  const Voxels* voxels,
   const unsigned char* obstacles,
   int* results,
   const int height,
@@ -170,8 +183,8 @@ const int findPath(
     results[p + 1] = node->y;
     results[p + 2] = node->z;
     results[p + 3] = (
-      (((unsigned char) ((float) voxels[light + VOXEL_LIGHT] / maxLight * 0xFF)) << 8)
-      | ((unsigned char) ((float) voxels[light + VOXEL_SUNLIGHT] / maxLight * 0xFF))
+      (((unsigned char) ((float) voxels->light[light * LIGHT_STRIDE + VOXEL_LIGHT] / maxLight * 0xFF)) << 8)
+      | ((unsigned char) ((float) voxels->light[light * LIGHT_STRIDE + VOXEL_SUNLIGHT] / maxLight * 0xFF))
     );
   }
   ASPathDestroy(path);
@@ -181,7 +194,7 @@ const int findPath(
 const unsigned char findTarget(
   const World* world,
   const int* heightmap,
-  const unsigned char* voxels,
+  const Voxels* voxels,
   const unsigned char* obstacles,
   int* point,
   const int height,
@@ -205,12 +218,12 @@ const unsigned char findTarget(
   point[1] = fromY + rand() % (toY - fromY);
   const int voxel = getVoxel(world, point[0], point[1], point[2]);
   if (
-    voxels[voxel] != TYPE_AIR || obstacles[voxel / VOXELS_STRIDE]
+    voxels->types[voxel] != TYPE_AIR || isObstacle(world, obstacles, point[0], point[1], point[2])
   ) {
     return 0;
   }
   for (int y = point[1] - 1; y >= world->seaLevel; y--) {
-    const int type = voxels[getVoxel(world, point[0], y, point[2])];
+    const int type = voxels->types[getVoxel(world, point[0], y, point[2])];
     if (type == TYPE_AIR || type == TYPE_TREE) {
       continue;
     }
@@ -218,8 +231,8 @@ const unsigned char findTarget(
     for (int h = 1; h <= height; h++) {
       const int voxel = getVoxel(world, point[0], y + h, point[2]);
       if (
-        voxels[voxel] != TYPE_AIR
-        || obstacles[voxel / VOXELS_STRIDE]
+        voxels->types[voxel] != TYPE_AIR
+        || isObstacle(world, obstacles, point[0], y + h, point[2])
       ) {
         isValid = false;
         break;
@@ -1,8 +1,12 @@
-const int colliders(
+// Boxes that cover the solid voxels of a chunk. Every box grows from its first voxel
+// (in z, y, x order) along z, then y & then x, over rows of bits (along x) of the voxels
+// that are solid and not covered yet. The rows get filled every call, so they don't need clearing.
+static const int getChunkColliders(
   const World* world,
-  const unsigned char* voxels,
+  const Voxels* voxels,
   unsigned char* colliders,
-  unsigned char* map,
+  unsigned int* hash,
+  unsigned long long* rows,
   const unsigned char chunkSize,
   const int chunkX,
   const int chunkY,
@@ -12,81 +16,374 @@ const int colliders(
     chunkX < 0
     || chunkY < 0
     || chunkZ < 0
-    || chunkX + chunkSize > world->width
-    || chunkY + chunkSize > world->height
-    || chunkZ + chunkSize > world->depth
+    || chunkX >= world->width
+    || chunkY >= world->height
+    || chunkZ >= world->depth
   ) {
     return -1;
   }
-  unsigned char width, height, depth;
-  int collider = 0;
-  for (unsigned char z = 0; z < chunkSize; z++) {
-    for (unsigned char y = 0; y < chunkSize; y++) {
-      for (unsigned char x = 0; x < chunkSize; x++) {
-        if (
-          voxels[getVoxel(world, chunkX + x, chunkY + y, chunkZ + z)] == TYPE_AIR
-          || map[z * chunkSize * chunkSize + y * chunkSize + x]
-        ) {
-          continue;
+  // The part of the chunk past the edges of the world is air
+  const int words = (chunkSize + 63) / 64,
+            maxX = world->width - chunkX < chunkSize ? world->width - chunkX : chunkSize,
+            maxY = world->height - chunkY < chunkSize ? world->height - chunkY : chunkSize,
+            maxZ = world->depth - chunkZ < chunkSize ? world->depth - chunkZ : chunkSize;
+  for (int z = 0, row = 0; z < chunkSize; z++) {
+    for (int y = 0; y < chunkSize; y++, row += words) {
+      for (int w = 0; w < words; w++) {
+        rows[row + w] = 0;
+      }
+      if (y >= maxY || z >= maxZ) {
+        continue;
+      }
+      // The voxels of a row are contiguous (until the next brick in the bricked layout)
+      for (int x = 0, voxel = -1; x < maxX; x++) {
+        if (voxel != -1 && ((chunkX + x) & (world->brickSize - 1)) != 0) {
+          voxel++;
+        } else {
+          voxel = getVoxel(world, chunkX + x, chunkY + y, chunkZ + z);
+        }
+        if (voxels->types[voxel] != TYPE_AIR) {
+          rows[row + x / 64] |= 1ULL << (x % 64);
         }
+      }
+    }
+  }
 
-        for (unsigned char i = z + 1; i <= chunkSize; i++) {
-          if (
-            i == chunkSize
-            || voxels[getVoxel(world, chunkX + x, chunkY + y, chunkZ + i)] == TYPE_AIR
-            || map[i * chunkSize * chunkSize + y * chunkSize + x]
+  unsigned long long span[words];
+  int collider = 0;
+  for (int z = 0; z < chunkSize; z++) {
+    for (int y = 0; y < chunkSize; y++) {
+      for (int word = 0; word < words; word++) {
+        unsigned long long* bits = &rows[(z * chunkSize + y) * words + word];
+        while (*bits) {
+          const int bit = __builtin_ctzll(*bits),
+                    x = word * 64 + bit;
+
+          int depth = 1;
+          while (
+            z + depth < chunkSize
+            && ((rows[((z + depth) * chunkSize + y) * words + word] >> bit) & 1)
           ) {
-            depth = i - z;
-            break;
+            depth++;
           }
-        }
 
-        height = chunkSize - y;
-        for (unsigned char i = z; i < z + depth; i++) {
-          for (unsigned char j = y + 1; j <= y + height; j++) {
-            if (
-              j == chunkSize
-              || voxels[getVoxel(world, chunkX + x, chunkY + j, chunkZ + i)] == TYPE_AIR
-              || map[i * chunkSize * chunkSize + j * chunkSize + x]
-            ) {
-              height = j - y;
+          int height = 1;
+          for (bool grow = true; grow && y + height < chunkSize; height += grow ? 1 : 0) {
+            for (int i = z; i < z + depth; i++) {
+              if (!((rows[(i * chunkSize + y + height) * words + word] >> bit) & 1)) {
+                grow = false;
+                break;
+              }
             }
           }
-        }
 
-        width = chunkSize - x;
-        for (unsigned char i = z; i < z + depth; i++) {
-          for (unsigned char j = y; j < y + height; j++) {
-            for (unsigned char k = x + 1; k <= x + width; k++) {
-              if (
-                k == chunkSize
-                || voxels[getVoxel(world, chunkX + k, chunkY + j, chunkZ + i)] == TYPE_AIR
-                || map[i * chunkSize * chunkSize + j * chunkSize + k]
-              ) {
-                width = k - x;
+          // The width is the run of bits from x that all the rows of the box have
+          for (int w = word; w < words; w++) {
+            span[w] = ~0ULL;
+          }
+          for (int i = z; i < z + depth; i++) {
+            for (int j = y; j < y + height; j++) {
+              for (int w = word; w < words; w++) {
+                span[w] &= rows[(i * chunkSize + j) * words + w];
               }
             }
           }
-        }
+          int width = 0;
+          for (int w = word, shift = bit; w < words; w++, shift = 0) {
+            const unsigned long long run = ~(span[w] >> shift);
+            const int length = run ? __builtin_ctzll(run) : 64;
+            width += length;
+            if (length < 64 - shift) {
+              break;
+            }
+          }
 
-        for (unsigned char i = z; i < z + depth; i++) {
-          for (unsigned char j = y; j < y + height; j++) {
-            for (unsigned char k = x; k < x + width; k++) {
-              map[i * chunkSize * chunkSize + j * chunkSize + k] = 1;
+          // Covers the box by clearing its bits from the rows
+          for (int w = word; w < words && w * 64 < x + width; w++) {
+            const int from = w == word ? bit : 0,
+                      to = x + width - w * 64;
+            span[w] = (to < 64 ? (1ULL << to) - 1 : ~0ULL) & ~((1ULL << from) - 1);
+          }
+          for (int i = z; i < z + depth; i++) {
+            for (int j = y; j < y + height; j++) {
+              for (int w = word; w < words && w * 64 < x + width; w++) {
+                rows[(i * chunkSize + j) * words + w] &= ~span[w];
+              }
             }
           }
-        }
 
-        colliders[collider] = x;
-        colliders[collider + 1] = y;
-        colliders[collider + 2] = z;
-        colliders[collider + 3] = width;
-        colliders[collider + 4] = height;
-        colliders[collider + 5] = depth;
-        collider += 6;
+          colliders[collider] = x;
+          colliders[collider + 1] = y;
+          colliders[collider + 2] = z;
+          colliders[collider + 3] = width;
+          colliders[collider + 4] = height;
+          colliders[collider + 5] = depth;
+          collider += 6;
+        }
       }
     }
   }
 
+  // FNV-1a of the boxes, so the callers can tell if they changed
+  *hash = 2166136261u;
+  for (int i = 0; i < collider; i++) {
+    *hash = (*hash ^ colliders[i]) * 16777619u;
+  }
   return collider / 6;
 }
+
+#define COLLIDERS_KERNEL(size) \
+  FLATTEN const int colliders##size( \
+    const World* world, \
+    const Voxels* voxels, \
+    unsigned char* colliders, \
+    unsigned int* hash, \
+    unsigned long long* rows, \
+    const int chunkX, \
+    const int chunkY, \
+    const int chunkZ \
+  ) { \
+    return getChunkColliders(world, voxels, colliders, hash, rows, size, chunkX, chunkY, chunkZ); \
+  }
+CHUNK_KERNEL_SIZES(COLLIDERS_KERNEL)
+
+#define COLLIDERS_KERNEL_CASE(size) \
+  case size: \
+    return colliders##size(world, voxels, colliders, hash, rows, chunkX, chunkY, chunkZ);
+
+const int colliders(
+  const World* world,
+  const Voxels* voxels,
+  unsigned char* colliders,
+  unsigned int* hash,
+  unsigned long long* rows,
+  const unsigned char chunkSize,
+  const int chunkX,
+  const int chunkY,
+  const int chunkZ
+) {
+  switch (chunkSize) {
+    CHUNK_KERNEL_SIZES(COLLIDERS_KERNEL_CASE)
+  }
+  return getChunkColliders(world, voxels, colliders, hash, rows, chunkSize, chunkX, chunkY, chunkZ);
+}
+
+// Amanatides & Woo voxel traversal: Steps the ray (in voxels) from one voxel boundary
+// to the next until it hits a solid voxel or goes past maxDistance or the world.
+// The direction must be normalized, so the distance is also in voxels.
+const float raycast(
+  const World* world,
+  const Voxels* voxels,
+  int* hit,
+  const float originX,
+  const float originY,
+  const float originZ,
+  const float directionX,
+  const float directionY,
+  const float directionZ,
+  const float maxDistance
+) {
+  const float origin[] = { originX, originY, originZ },
+              direction[] = { directionX, directionY, directionZ };
+  const int size[] = { world->width, world->height, world->depth };
+
+  // Clips the ray to the bounds of the world
+  float distance = 0, far = maxDistance;
+  int axis = -1;
+  for (int i = 0; i < 3; i++) {
+    if (direction[i] == 0) {
+      if (origin[i] < 0 || origin[i] >= size[i]) {
+        return -1;
+      }
+      continue;
+    }
+    float enter = -origin[i] / direction[i],
+          exit = (size[i] - origin[i]) / direction[i];
+    if (enter > exit) {
+      const float swap = enter;
+      enter = exit;
+      exit = swap;
+    }
+    if (enter > distance) {
+      distance = enter;
+      axis = i;
+    }
+    if (exit < far) {
+      far = exit;
+    }
+  }
+  if (distance > far) {
+    return -1;
+  }
+
+  int voxel[3], step[3];
+  float next[3], delta[3];
+  for (int i = 0; i < 3; i++) {
+    voxel[i] = (int) floorf(origin[i] + direction[i] * distance);
+    // The entry point can round onto the far side of the edge voxels
+    voxel[i] = voxel[i] < 0 ? 0 : (voxel[i] >= size[i] ? size[i] - 1 : voxel[i]);
+    step[i] = direction[i] > 0 ? 1 : -1;
+    if (direction[i] == 0) {
+      // Never the closest boundary
+      next[i] = delta[i] = far + 1;
+    } else {
+      next[i] = (voxel[i] + (direction[i] > 0 ? 1 : 0) - origin[i]) / direction[i];
+      delta[i] = step[i] / direction[i];
+    }
+  }
+
+  while (true) {
+    if (voxels->types[getVoxel(world, voxel[0], voxel[1], voxel[2])] != TYPE_AIR) {
+      hit[0] = voxel[0];
+      hit[1] = voxel[1];
+      hit[2] = voxel[2];
+      // The face it entered through (none if the ray started inside the voxel)
+      hit[3] = hit[4] = hit[5] = 0;
+      if (axis != -1) {
+        hit[3 + axis] = -step[axis];
+      }
+      return distance;
+    }
+    axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+    distance = next[axis];
+    voxel[axis] += step[axis];
+    if (distance > far || voxel[axis] < 0 || voxel[axis] >= size[axis]) {
+      return -1;
+    }
+    next[axis] += delta[axis];
+  }
+}
+
+// Gap that sweep leaves between the boxes and the voxels, so they don't start the next move touching them
+static const float sweepSkin = 0.001f;
+
+// Moves a box (in voxels) along an axis up to the first layer of voxels that has any solid
+// voxel under the box. The layers the box already overlaps are skipped, so a box that
+// starts inside a voxel can only get stopped, never pushed back.
+// Updates the box and returns whether it got blocked.
+static const bool sweepAxis(
+  const World* world,
+  const Voxels* voxels,
+  float* min,
+  float* max,
+  const int axis,
+  float move
+) {
+  if (move == 0) {
+    return false;
+  }
+  const int size[] = { world->width, world->height, world->depth },
+            a = (axis + 1) % 3,
+            b = (axis + 2) % 3;
+  int from[3], to[3];
+  for (int i = 0; i < 3; i++) {
+    from[i] = (int) floorf(min[i]);
+    to[i] = (int) ceilf(max[i]) - 1;
+    from[i] = from[i] < 0 ? 0 : from[i];
+    to[i] = to[i] >= size[i] ? size[i] - 1 : to[i];
+  }
+  bool blocked = false;
+  // The layers the leading side of the box enters (outside the world is air)
+  const int direction = move > 0 ? 1 : -1;
+  int layer = move > 0 ? (int) ceilf(max[axis]) : (int) floorf(min[axis]) - 1;
+  if (move > 0 && layer < 0) {
+    layer = 0;
+  } else if (move < 0 && layer >= size[axis]) {
+    layer = size[axis] - 1;
+  }
+  for (
+    ;
+    layer >= 0 && layer < size[axis] && (
+      move > 0 ? layer < max[axis] + move : layer + 1 > min[axis] + move
+    );
+    layer += direction
+  ) {
+    int voxel[3];
+    voxel[axis] = layer;
+    for (voxel[a] = from[a]; !blocked && voxel[a] <= to[a]; voxel[a]++) {
+      for (voxel[b] = from[b]; voxel[b] <= to[b]; voxel[b]++) {
+        if (voxels->types[getVoxel(world, voxel[0], voxel[1], voxel[2])] != TYPE_AIR) {
+          blocked = true;
+          break;
+        }
+      }
+    }
+    if (blocked) {
+      move = move > 0 ? fmaxf(layer - max[axis] - sweepSkin, 0) : fminf(layer + 1 - min[axis] + sweepSkin, 0);
+      break;
+    }
+  }
+  min[axis] += move;
+  max[axis] += move;
+  return blocked;
+}
+
+// Collide & slide: Moves the box along y and then along x & z, so the blocked axes
+// just drop their part of the move. When a grounded box (resting on a voxel at the start
+// or landing on one) gets blocked along x or z, it retries the move from stepHeight above
+// and keeps it if it goes further.
+const int sweep(
+  const World* world,
+  const Voxels* voxels,
+  float* position,
+  const float radius,
+  const float height,
+  const float stepHeight,
+  const float moveX,
+  const float moveY,
+  const float moveZ
+) {
+  float min[] = { position[0] - radius, position[1], position[2] - radius },
+        max[] = { position[0] + radius, position[1] + height, position[2] + radius };
+  int contacts = 0;
+  bool grounded;
+  {
+    float probeMin[] = { min[0], min[1], min[2] },
+          probeMax[] = { max[0], max[1], max[2] };
+    grounded = sweepAxis(world, voxels, probeMin, probeMax, 1, -2 * sweepSkin);
+  }
+  if (sweepAxis(world, voxels, min, max, 1, moveY)) {
+    if (moveY < 0) {
+      grounded = true;
+    } else {
+      contacts |= SWEEP_CEILING;
+    }
+  }
+  if (grounded && moveY <= 0) {
+    contacts |= SWEEP_GROUND;
+  }
+
+  float stepMin[] = { min[0], min[1], min[2] },
+        stepMax[] = { max[0], max[1], max[2] };
+  const bool blockedX = sweepAxis(world, voxels, min, max, 0, moveX),
+             blockedZ = sweepAxis(world, voxels, min, max, 2, moveZ);
+  if (blockedX || blockedZ) {
+    contacts |= SWEEP_WALL;
+    if (stepHeight > 0 && grounded) {
+      const float ground = stepMin[1];
+      sweepAxis(world, voxels, stepMin, stepMax, 1, stepHeight);
+      const bool stepBlockedX = sweepAxis(world, voxels, stepMin, stepMax, 0, moveX),
+                 stepBlockedZ = sweepAxis(world, voxels, stepMin, stepMax, 2, moveZ);
+      sweepAxis(world, voxels, stepMin, stepMax, 1, ground - stepMin[1]);
+      const float x = min[0] - position[0] + radius,
+                  z = min[2] - position[2] + radius,
+                  stepX = stepMin[0] - position[0] + radius,
+                  stepZ = stepMin[2] - position[2] + radius;
+      if (stepX * stepX + stepZ * stepZ > x * x + z * z) {
+        for (int i = 0; i < 3; i++) {
+          min[i] = stepMin[i];
+          max[i] = stepMax[i];
+        }
+        contacts |= SWEEP_STEP;
+        if (!stepBlockedX && !stepBlockedZ) {
+          contacts &= ~SWEEP_WALL;
+        }
+      }
+    }
+  }
+
+  position[0] = min[0] + radius;
+  position[1] = min[1];
+  position[2] = min[2] + radius;
+  return contacts;
+}
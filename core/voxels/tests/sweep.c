@@ -0,0 +1,86 @@
+// Native tests of sweep (ctest --test-dir build)
+//
+// Every case builds a small linear world: a floor 4 voxels tall,
+// with a ledge 1 voxel tall from x = 8.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "voxels.h"
+
+static const int width = 16;
+static const int height = 16;
+static const int depth = 16;
+static const float radius = 0.4f;
+static const float boxHeight = 1.5f;
+static const float stepHeight = 1.1f;
+
+static int failures = 0;
+
+#define CHECK(condition, name) \
+  if (!(condition)) { \
+    fprintf(stderr, "FAIL %s: %s (position %.4f, %.4f, %.4f contacts %d)\n", name, #condition, position[0], position[1], position[2], contacts); \
+    failures++; \
+  }
+
+static void setType(const World* world, const Voxels* voxels, const int x, const int y, const int z, const unsigned char type) {
+  // Linear layout (brickSize 0)
+  voxels->types[z * world->width * world->height + y * world->width + x] = type;
+}
+
+static void createGround(const World* world, const Voxels* voxels) {
+  for (int z = 0; z < world->depth; z++) {
+    for (int x = 0; x < world->width; x++) {
+      for (int y = 0; y < 4; y++) {
+        setType(world, voxels, x, y, z, TYPE_STONE);
+      }
+      if (x >= 8) {
+        setType(world, voxels, x, 4, z, TYPE_STONE);
+      }
+    }
+  }
+}
+
+static void testStartOverlapping(const World* world, const Voxels* voxels) {
+  // Sunk halfway into the top layer of the floor, moving down: it stops at the next layer
+  float position[] = { 4.5f, 3.5f, 8.5f };
+  const int contacts = sweep(world, voxels, position, radius, boxHeight, 0, 0, -1, 0);
+  CHECK(contacts == SWEEP_GROUND, "start overlapping");
+  CHECK(position[1] <= 3.5f, "start overlapping: not pushed up");
+  CHECK(fabsf(position[1] - 3.001f) < 1e-4f, "start overlapping: stops on the layer below");
+}
+
+static void testStepWithoutFalling(const World* world, const Voxels* voxels) {
+  // Resting on the floor, walking into the ledge with no vertical move
+  float position[] = { 6.5f, 4.001f, 8.5f };
+  const int contacts = sweep(world, voxels, position, radius, boxHeight, stepHeight, 1.5f, 0, 0);
+  CHECK(contacts == (SWEEP_GROUND | SWEEP_STEP), "step without falling");
+  CHECK(fabsf(position[0] - 8.0f) < 1e-4f, "step without falling: keeps the whole move");
+  CHECK(fabsf(position[1] - 5.001f) < 1e-4f, "step without falling: lands on the ledge");
+}
+
+static void testNoStepInTheAir(const World* world, const Voxels* voxels) {
+  // Same move, but floating above the floor
+  float position[] = { 6.5f, 4.5f, 8.5f };
+  const int contacts = sweep(world, voxels, position, radius, boxHeight, stepHeight, 1.5f, 0, 0);
+  CHECK(contacts == SWEEP_WALL, "no step in the air");
+  CHECK(fabsf(position[0] - 7.599f) < 1e-4f, "no step in the air: stops at the ledge");
+  CHECK(position[1] == 4.5f, "no step in the air: stays at the same height");
+}
+
+int main() {
+  const int cells = width * height * depth;
+  unsigned char* planes = calloc(cells * 6, 1);
+  const World world = { width, height, depth, 0, 0, NULL, NULL };
+  const Voxels voxels = { planes, planes + cells, planes + cells * 4 };
+  createGround(&world, &voxels);
+  testStartOverlapping(&world, &voxels);
+  testStepWithoutFalling(&world, &voxels);
+  testNoStepInTheAir(&world, &voxels);
+  free(planes);
+  if (failures > 0) {
+    return 1;
+  }
+  printf("sweep: all passed\n");
+  return 0;
+}
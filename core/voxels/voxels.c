@@ -1,34 +1,17 @@
 #include <math.h>
 #include <stdbool.h> 
 #include <stdlib.h>
-
-enum BlockTypes {
-  TYPE_AIR,
-  TYPE_DIRT,
-  TYPE_LIGHT,
-  TYPE_STONE,
-  TYPE_TREE
-};
-
-enum VoxelFields {
-  VOXEL_TYPE,
-  VOXEL_R,
-  VOXEL_G,
-  VOXEL_B,
-  VOXEL_LIGHT,
-  VOXEL_SUNLIGHT,
-  VOXELS_STRIDE
-};
-
-typedef struct {
-  const int width;
-  const int height;
-  const int depth;
-  const int seaLevel;
-} World;
+#include <string.h>
+#include "voxels.h"
 
 static const unsigned char maxLight = 16;
 
+// Chunk sizes that get their own copy of the chunk kernels (mesh & colliders).
+// The copies have all their calls inlined (flatten), so the strides & loop bounds
+// are constants. Any other chunk size goes through the generic kernels.
+#define CHUNK_KERNEL_SIZES(KERNEL_SIZE) KERNEL_SIZE(16) KERNEL_SIZE(32)
+#define FLATTEN static __attribute__((flatten))
+
 static const int neighbors[] = {
   0, -1, 0,
   1, 0, 0,
@@ -38,6 +21,16 @@ static const int neighbors[] = {
   0, 1, 0
 };
 
+static const int getBrick(
+  const World* world,
+  const int x,
+  const int y,
+  const int z
+) {
+  const int shift = __builtin_ctz(world->brickSize);
+  return ((z >> shift) * (world->height >> shift) + (y >> shift)) * (world->width >> shift) + (x >> shift);
+}
+
 static const int getVoxel(
   const World* world,
   const int x,
@@ -51,29 +44,473 @@ static const int getVoxel(
   ) {
     return -1;
   }
-  return (z * world->width * world->height + y * world->width + x) * VOXELS_STRIDE;
+  if (world->brickSize) {
+    // Bricked layout: Each brickSize^3 brick is stored contiguously
+    const int shift = __builtin_ctz(world->brickSize),
+              mask = world->brickSize - 1,
+              brick = getBrick(world, x, y, z),
+              slot = world->store ? world->store->bricks[brick] : brick;
+    return (
+      (slot << (shift * 3))
+      | ((z & mask) << (shift * 2))
+      | ((y & mask) << shift)
+      | (x & mask)
+    );
+  }
+  return z * world->width * world->height + y * world->width + x;
+}
+
+// The queues store packed positions instead of voxels,
+// since a voxel can be shared by several bricks in the sparse storage.
+static const int getPositionBits(const int size) {
+  return size > 1 ? 32 - __builtin_clz(size - 1) : 0;
+}
+
+static const int packPosition(
+  const World* world,
+  const int x,
+  const int y,
+  const int z
+) {
+  const int bitsX = getPositionBits(world->width),
+            bitsY = getPositionBits(world->height);
+  return (z << (bitsX + bitsY)) | (y << bitsX) | x;
+}
+
+static void unpackPosition(
+  const World* world,
+  const int position,
+  int* x,
+  int* y,
+  int* z
+) {
+  const int bitsX = getPositionBits(world->width),
+            bitsY = getPositionBits(world->height);
+  *x = position & ((1 << bitsX) - 1);
+  *y = (position >> bitsX) & ((1 << bitsY) - 1);
+  *z = position >> (bitsX + bitsY);
+}
+
+static void markChunks(
+  const World* world,
+  const int x,
+  const int y,
+  const int z,
+  const unsigned char flags
+) {
+  DirtyChunks* const dirty = world->dirty;
+  if (dirty == NULL) {
+    return;
+  }
+  const int size = dirty->chunkSize,
+            margin = dirty->margin,
+            chunksX = world->width / size,
+            chunksY = world->height / size,
+            chunksZ = world->depth / size,
+            chunkX = x / size,
+            chunkY = y / size,
+            chunkZ = z / size;
+  // The meshes also read the voxels around their chunk
+  for (int cz = (z > margin ? z - margin : 0) / size; cz <= (z + margin) / size && cz < chunksZ; cz++) {
+    for (int cy = (y > margin ? y - margin : 0) / size; cy <= (y + margin) / size && cy < chunksY; cy++) {
+      for (int cx = (x > margin ? x - margin : 0) / size; cx <= (x + margin) / size && cx < chunksX; cx++) {
+        const int chunk = (cz * chunksY + cy) * chunksX + cx;
+        const unsigned char flag = cx == chunkX && cy == chunkY && cz == chunkZ ? flags : (flags & (CHUNK_MESH | CHUNK_LIGHT));
+        if ((dirty->chunks[chunk] & flag) != flag) {
+          if (dirty->chunks[chunk] == 0) {
+            dirty->list[dirty->count++] = chunk;
+          }
+          dirty->chunks[chunk] |= flag;
+        }
+      }
+    }
+  }
+}
+
+static const bool isUniformSlot(
+  const World* world,
+  const Voxels* voxels,
+  const int slot
+) {
+  const int cells = world->brickSize * world->brickSize * world->brickSize;
+  const unsigned char* types = voxels->types + slot * cells;
+  const unsigned char* colors = voxels->colors + slot * cells * COLORS_STRIDE;
+  const unsigned char* light = voxels->light + slot * cells * LIGHT_STRIDE;
+  // A plane is uniform when it's equal to itself shifted by one voxel
+  return (
+    memcmp(types, types + 1, cells - 1) == 0
+    && memcmp(colors, colors + COLORS_STRIDE, (cells - 1) * COLORS_STRIDE) == 0
+    && memcmp(light, light + LIGHT_STRIDE, (cells - 1) * LIGHT_STRIDE) == 0
+  );
+}
+
+static const bool isEqualSlot(
+  const World* world,
+  const Voxels* voxels,
+  const int a,
+  const int b
+) {
+  // Only valid for uniform slots
+  const int cells = world->brickSize * world->brickSize * world->brickSize;
+  return (
+    voxels->types[a * cells] == voxels->types[b * cells]
+    && memcmp(voxels->colors + a * cells * COLORS_STRIDE, voxels->colors + b * cells * COLORS_STRIDE, COLORS_STRIDE) == 0
+    && memcmp(voxels->light + a * cells * LIGHT_STRIDE, voxels->light + b * cells * LIGHT_STRIDE, LIGHT_STRIDE) == 0
+  );
+}
+
+void clear(
+  const World* world,
+  const Voxels* voxels
+) {
+  VoxelStore* store = world->store;
+  if (store == NULL) {
+    const int cells = world->width * world->height * world->depth;
+    memset(voxels->types, 0, cells);
+    memset(voxels->colors, 0, cells * COLORS_STRIDE);
+    memset(voxels->light, 0, cells * LIGHT_STRIDE);
+    return;
+  }
+  // Every brick points to a single empty slot
+  const int cells = world->brickSize * world->brickSize * world->brickSize,
+            bricks = (world->width * world->height * world->depth) / cells;
+  memset(voxels->types, 0, cells);
+  memset(voxels->colors, 0, cells * COLORS_STRIDE);
+  memset(voxels->light, 0, cells * LIGHT_STRIDE);
+  memset(store->bricks, 0, bricks * sizeof(int));
+  memset(store->references, 0, store->capacity * sizeof(int));
+  store->references[0] = bricks;
+  store->used = 1;
+  store->overflow = 0;
+  store->next = 1 % store->capacity;
+}
+
+void compact(
+  const World* world,
+  const Voxels* voxels
+) {
+  VoxelStore* store = world->store;
+  if (store == NULL) {
+    return;
+  }
+  const int bricks = (world->width * world->height * world->depth) / (world->brickSize * world->brickSize * world->brickSize);
+  // The uniform slots found so far (there can't be more of them than slots)
+  int* uniform = store->scratch;
+  int count = 0;
+  // Shared slots are always uniform
+  for (int slot = 0; slot < store->capacity; slot++) {
+    if (store->references[slot] > 1) {
+      uniform[count++] = slot;
+    }
+  }
+  for (int brick = 0; brick < bricks; brick++) {
+    const int slot = store->bricks[brick];
+    if (store->references[slot] != 1 || !isUniformSlot(world, voxels, slot)) {
+      continue;
+    }
+    int shared = -1;
+    for (int i = 0; i < count; i++) {
+      if (isEqualSlot(world, voxels, uniform[i], slot)) {
+        shared = uniform[i];
+        break;
+      }
+    }
+    if (shared == -1) {
+      uniform[count++] = slot;
+      continue;
+    }
+    store->bricks[brick] = shared;
+    store->references[shared]++;
+    store->references[slot] = 0;
+    store->used--;
+  }
+}
+
+// Returns the voxel (at x, y, z) in a slot that is only used by its brick.
+// In the sparse storage, this copies the brick into a free slot when it was shared
+// and compacts the store when it's full. Any other voxel obtained before calling this
+// should be considered stale. Returns -1 if it's out of bounds or the store is full.
+static const int unshareVoxel(
+  const World* world,
+  const Voxels* voxels,
+  const int voxel,
+  const int x,
+  const int y,
+  const int z
+) {
+  VoxelStore* store = world->store;
+  if (voxel == -1 || store == NULL) {
+    return voxel;
+  }
+  const int shift = __builtin_ctz(world->brickSize),
+            cells = 1 << (shift * 3),
+            brick = getBrick(world, x, y, z),
+            slot = store->bricks[brick];
+  if (store->references[slot] == 1) {
+    return voxel;
+  }
+  if (store->used >= store->capacity) {
+    compact(world, voxels);
+    if (store->used >= store->capacity) {
+      store->overflow++;
+      return -1;
+    }
+  }
+  int target = store->next;
+  while (store->references[target] != 0) {
+    target = (target + 1) % store->capacity;
+  }
+  memcpy(voxels->types + target * cells, voxels->types + slot * cells, cells);
+  memcpy(voxels->colors + target * cells * COLORS_STRIDE, voxels->colors + slot * cells * COLORS_STRIDE, cells * COLORS_STRIDE);
+  memcpy(voxels->light + target * cells * LIGHT_STRIDE, voxels->light + slot * cells * LIGHT_STRIDE, cells * LIGHT_STRIDE);
+  store->references[slot]--;
+  store->references[target] = 1;
+  store->bricks[brick] = target;
+  store->used++;
+  store->next = (target + 1) % store->capacity;
+  return (target << (shift * 3)) | (voxel & (cells - 1));
+}
+
+const int unshare(
+  const World* world,
+  const Voxels* voxels,
+  const int x,
+  const int y,
+  const int z
+) {
+  return unshareVoxel(world, voxels, getVoxel(world, x, y, z), x, y, z);
+}
+
+static void transcodeVoxel(
+  const Voxels* voxels,
+  unsigned char* linear,
+  const int voxel,
+  const bool toLinear
+) {
+  unsigned char* colors = voxels->colors + voxel * COLORS_STRIDE;
+  unsigned char* light = voxels->light + voxel * LIGHT_STRIDE;
+  if (toLinear) {
+    linear[0] = voxels->types[voxel];
+    linear[1] = colors[VOXEL_R];
+    linear[2] = colors[VOXEL_G];
+    linear[3] = colors[VOXEL_B];
+    linear[4] = light[VOXEL_LIGHT];
+    linear[5] = light[VOXEL_SUNLIGHT];
+  } else {
+    voxels->types[voxel] = linear[0];
+    colors[VOXEL_R] = linear[1];
+    colors[VOXEL_G] = linear[2];
+    colors[VOXEL_B] = linear[3];
+    light[VOXEL_LIGHT] = linear[4];
+    light[VOXEL_SUNLIGHT] = linear[5];
+  }
+}
+
+const int transcode(
+  const World* world,
+  const Voxels* voxels,
+  unsigned char* linear,
+  const bool toLinear,
+  const int fromZ,
+  const int toZ
+) {
+  if (fromZ < 0 || toZ > world->depth || fromZ >= toZ) {
+    return -1;
+  }
+  const int row = world->width * 6,
+            slice = world->height * row;
+  if (world->store == NULL || toLinear) {
+    for (int z = fromZ; z < toZ; z++) {
+      for (int y = 0; y < world->height; y++) {
+        unsigned char* fields = linear + (z - fromZ) * slice + y * row;
+        // The voxels of a row are contiguous (until the next brick in the bricked layout)
+        for (int x = 0, voxel = -1; x < world->width; x++, fields += 6) {
+          if (voxel != -1 && (x & (world->brickSize - 1)) != 0) {
+            voxel++;
+          } else {
+            voxel = getVoxel(world, x, y, z);
+          }
+          transcodeVoxel(voxels, fields, voxel, toLinear);
+        }
+      }
+    }
+    return 0;
+  }
+  // Sparse storage: Only unshares the bricks that are not empty.
+  // The slices must cover whole bricks and the world must be cleared before loading it.
+  const int size = world->brickSize;
+  if (fromZ % size != 0 || toZ % size != 0) {
+    return -1;
+  }
+  for (int z = fromZ; z < toZ; z += size) {
+    for (int y = 0; y < world->height; y += size) {
+      for (int x = 0; x < world->width; x += size) {
+        bool isEmpty = true;
+        for (int bz = 0; isEmpty && bz < size; bz++) {
+          for (int by = 0; isEmpty && by < size; by++) {
+            const unsigned char* fields = linear + (z + bz - fromZ) * slice + (y + by) * row + x * 6;
+            for (int i = 0; i < size * 6; i++) {
+              if (fields[i] != 0) {
+                isEmpty = false;
+                break;
+              }
+            }
+          }
+        }
+        if (isEmpty) {
+          continue;
+        }
+        // Bricks are stored contiguously, so this is the first voxel of the brick
+        const int voxel = unshareVoxel(world, voxels, getVoxel(world, x, y, z), x, y, z);
+        if (voxel == -1) {
+          return -1;
+        }
+        for (int bz = 0, cell = 0; bz < size; bz++) {
+          for (int by = 0; by < size; by++) {
+            unsigned char* fields = linear + (z + bz - fromZ) * slice + (y + by) * row + x * 6;
+            for (int bx = 0; bx < size; bx++, cell++, fields += 6) {
+              transcodeVoxel(voxels, fields, voxel + cell, false);
+            }
+          }
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+// Ring buffer of packed positions (followed by the light being removed, when the stride is 2).
+// Nodes that don't fit are flagged in the pending bitmap (one bit per voxel in the linear layout)
+// and requeued when it drains, so it can't overflow.
+typedef struct {
+  int* const nodes;
+  unsigned char* const pending;
+  const unsigned int capacity;
+  const unsigned char stride;
+  unsigned int head;
+  unsigned int length;
+  unsigned int pendingCount;
+  unsigned int pendingCursor;
+} LightQueue;
+
+static LightQueue createLightQueue(
+  int* nodes,
+  unsigned char* pending,
+  const int capacity,
+  const unsigned char stride
+) {
+  return (LightQueue) { nodes, pending, capacity - (capacity % stride), stride, 0, 0, 0, 0 };
+}
+
+static const bool pushLight(
+  const World* world,
+  LightQueues* queues,
+  LightQueue* queue,
+  const int x,
+  const int y,
+  const int z,
+  const unsigned char light
+) {
+  if (queue->length + queue->stride > queue->capacity) {
+    const int index = z * world->width * world->height + y * world->width + x;
+    const unsigned char bit = 1 << (index & 7);
+    if (!(queue->pending[index >> 3] & bit)) {
+      queue->pending[index >> 3] |= bit;
+      queue->pendingCount++;
+      queues->deferred++;
+    }
+    return false;
+  }
+  const unsigned int tail = (queue->head + queue->length) % queue->capacity;
+  queue->nodes[tail] = packPosition(world, x, y, z);
+  if (queue->stride == 2) {
+    queue->nodes[tail + 1] = light;
+  }
+  queue->length += queue->stride;
+  return true;
+}
+
+static void requeueLight(
+  const unsigned char channel,
+  const World* world,
+  const Voxels* voxels,
+  LightQueues* queues,
+  LightQueue* queue
+) {
+  const unsigned int size = (world->width * world->height * world->depth + 7) / 8;
+  while (queue->pendingCount > 0 && queue->length + queue->stride <= queue->capacity) {
+    const unsigned char bits = queue->pending[queue->pendingCursor];
+    if (bits == 0) {
+      queue->pendingCursor = (queue->pendingCursor + 1) % size;
+      continue;
+    }
+    const int bit = __builtin_ctz(bits),
+              index = queue->pendingCursor * 8 + bit,
+              z = index / (world->width * world->height),
+              y = (index % (world->width * world->height)) / world->width,
+              x = (index % (world->width * world->height)) % world->width;
+    queue->pending[queue->pendingCursor] &= ~(1 << bit);
+    queue->pendingCount--;
+    if (queue->stride == 1) {
+      pushLight(world, queues, queue, x, y, z, 0);
+      continue;
+    }
+    // Pending removals keep their light until they get requeued
+    const int voxel = unshare(world, voxels, x, y, z);
+    if (voxel == -1) {
+      continue;
+    }
+    const unsigned char light = voxels->light[voxel * LIGHT_STRIDE + channel];
+    if (light != 0) {
+      voxels->light[voxel * LIGHT_STRIDE + channel] = 0;
+      markChunks(world, x, y, z, CHUNK_LIGHT);
+      pushLight(world, queues, queue, x, y, z, light);
+    }
+  }
+}
+
+static const bool popLight(
+  const unsigned char channel,
+  const World* world,
+  const Voxels* voxels,
+  LightQueues* queues,
+  LightQueue* queue,
+  int* x,
+  int* y,
+  int* z,
+  unsigned char* light
+) {
+  if (queue->length == 0) {
+    requeueLight(channel, world, voxels, queues, queue);
+    if (queue->length == 0) {
+      return false;
+    }
+  }
+  unpackPosition(world, queue->nodes[queue->head], x, y, z);
+  if (queue->stride == 2) {
+    *light = queue->nodes[queue->head + 1];
+  }
+  queue->head = (queue->head + queue->stride) % queue->capacity;
+  queue->length -= queue->stride;
+  queues->nodes++;
+  return true;
 }
 
 static void floodLight(
   const unsigned char channel,
   const World* world,
   const int* heightmap,
-  unsigned char* voxels,
-  int* queue,
-  const unsigned int size,
-  int* next
+  const Voxels* voxels,
+  LightQueues* queues,
+  LightQueue* queue
 ) {
-  unsigned int nextLength = 0;
-  for (unsigned int i = 0; i < size; i++) {
-    const int voxel = queue[i];
-    const unsigned char light = voxels[voxel + channel];
+  int x, y, z;
+  unsigned char light;
+  while (popLight(channel, world, voxels, queues, queue, &x, &y, &z, &light)) {
+    light = voxels->light[getVoxel(world, x, y, z) * LIGHT_STRIDE + channel];
     if (light == 0) {
       continue;
     }
-    const int index = voxel / VOXELS_STRIDE,
-              z = floor(index / (world->width * world->height)),
-              y = floor((index % (world->width * world->height)) / world->width),
-              x = floor((index % (world->width * world->height)) % world->width);
     for (unsigned char n = 0; n < 6; n++) {
       const int nx = x + neighbors[n * 3],
                 ny = y + neighbors[n * 3 + 1],
@@ -86,64 +523,56 @@ static void floodLight(
       );
       if (
         neighbor == -1
-        || voxels[neighbor] != TYPE_AIR
+        || voxels->types[neighbor] != TYPE_AIR
         || (
           channel == VOXEL_SUNLIGHT
           && n != 0
           && light == maxLight
           && ny > heightmap[(nz * world->width) + nx]
         )
-        || voxels[neighbor + channel] >= nl
+        || voxels->light[neighbor * LIGHT_STRIDE + channel] >= nl
       ) {
         continue;
       }
-      voxels[neighbor + channel] = nl;
-      next[nextLength++] = neighbor;
+      const int writable = unshareVoxel(world, voxels, neighbor, nx, ny, nz);
+      if (writable == -1) {
+        continue;
+      }
+      voxels->light[writable * LIGHT_STRIDE + channel] = nl;
+      markChunks(world, nx, ny, nz, CHUNK_LIGHT);
+      pushLight(world, queues, queue, nx, ny, nz, 0);
     }
   }
-  if (nextLength > 0) {
-    floodLight(
-      channel,
-      world,
-      heightmap,
-      voxels,
-      next,
-      nextLength,
-      queue
-    );
-  }
 }
 
 static void removeLight(
   const unsigned char channel,
   const World* world,
   const int* heightmap,
-  unsigned char* voxels,
-  int* queue,
-  const unsigned int size,
-  int* next,
-  int* floodQueue,
-  unsigned int floodQueueSize
+  const Voxels* voxels,
+  LightQueues* queues,
+  LightQueue* queue,
+  LightQueue* floodQueue
 ) {
-  unsigned int nextLength = 0;
-  for (int i = 0; i < size; i += 2) {
-    const int voxel = queue[i];
-    const unsigned char light = queue[i + 1];
-    const int index = voxel / VOXELS_STRIDE,
-              z = floor(index / (world->width * world->height)),
-              y = floor((index % (world->width * world->height)) / world->width),
-              x = floor((index % (world->width * world->height)) % world->width);
+  int x, y, z;
+  unsigned char light;
+  while (popLight(channel, world, voxels, queues, queue, &x, &y, &z, &light)) {
     for (unsigned char n = 0; n < 6; n++) {
-      const int neighbor = getVoxel(
-        world,
-        x + neighbors[n * 3],
-        y + neighbors[n * 3 + 1],
-        z + neighbors[n * 3 + 2]
-      );
-      if (neighbor == -1 || voxels[neighbor] != TYPE_AIR) {
+      const int nx = x + neighbors[n * 3],
+                ny = y + neighbors[n * 3 + 1],
+                nz = z + neighbors[n * 3 + 2],
+                neighbor = getVoxel(world, nx, ny, nz);
+      if (neighbor == -1) {
+        continue;
+      }
+      if (voxels->types[neighbor] != TYPE_AIR) {
+        // Sources next to the removed light need to flood it back
+        if (channel == VOXEL_LIGHT && voxels->types[neighbor] == TYPE_LIGHT) {
+          pushLight(world, queues, floodQueue, nx, ny, nz, 0);
+        }
         continue;
       }
-      const unsigned char nl = voxels[neighbor + channel];
+      const unsigned char nl = voxels->light[neighbor * LIGHT_STRIDE + channel];
       if (nl == 0) {
         continue;
       }
@@ -156,60 +585,71 @@ static void removeLight(
           && nl == maxLight
         )
       ) {
-        next[nextLength++] = neighbor;
-        next[nextLength++] = nl;
-        voxels[neighbor + channel] = 0;
+        const int writable = unshareVoxel(world, voxels, neighbor, nx, ny, nz);
+        if (writable != -1 && pushLight(world, queues, queue, nx, ny, nz, nl)) {
+          voxels->light[writable * LIGHT_STRIDE + channel] = 0;
+          markChunks(world, nx, ny, nz, CHUNK_LIGHT);
+        }
       } else if (nl >= light) {
-        floodQueue[floodQueueSize++] = neighbor;
+        pushLight(world, queues, floodQueue, nx, ny, nz, 0);
       }
     }
   }
-  if (nextLength > 0) {
-    removeLight(
-      channel,
-      world,
-      heightmap,
-      voxels,
-      next,
-      nextLength,
-      queue,
-      floodQueue,
-      floodQueueSize
-    );
-  } else if (floodQueueSize > 0) {
-    floodLight(
-      channel,
-      world,
-      heightmap,
-      voxels,
-      floodQueue,
-      floodQueueSize,
-      queue
-    );
-  }
+  floodLight(
+    channel,
+    world,
+    heightmap,
+    voxels,
+    queues,
+    floodQueue
+  );
 }
 
 void propagate(
   const World* world,
   const int* heightmap,
-  unsigned char* voxels,
-  int* queueA,
-  int* queueB,
-  int* queueC
+  const Voxels* voxels,
+  LightQueues* queues
 ) {
-  unsigned int lightQueueSize = 0;
-  unsigned int sunlightQueueSize = 0;
-  for (int z = 0, voxel = 0; z < world->depth; z++) {
-    for (int y = 0; y < world->height; y++) {
-      for (int x = 0; x < world->width; x++, voxel += VOXELS_STRIDE) {
-        if (y == world->height - 1 && voxels[voxel] == TYPE_AIR) {
-          voxels[voxel + VOXEL_SUNLIGHT] = maxLight;
-          queueA[sunlightQueueSize++] = voxel;
-        } else if (voxels[voxel] == TYPE_LIGHT) {
-          voxels[voxel + VOXEL_LIGHT] = maxLight;
-          queueB[lightQueueSize++] = voxel;
+  // Everything gets relit, so there's no point in tracking the chunks
+  const World untracked = {
+    world->width,
+    world->height,
+    world->depth,
+    world->seaLevel,
+    world->brickSize,
+    world->store,
+    NULL
+  };
+  world = &untracked;
+  LightQueue queue = createLightQueue(queues->queue, queues->pending, queues->capacity, 1);
+  // Direct sunlight goes straight down every column until it hits something.
+  // Since it only spreads sideways below the heightmap of the neighbor columns,
+  // that's the only part of the columns that needs to be flooded.
+  for (int z = 0; z < world->depth; z++) {
+    for (int x = 0; x < world->width; x++) {
+      int y = world->height - 1;
+      for (; y >= 0; y--) {
+        const int voxel = getVoxel(world, x, y, z);
+        if (voxels->types[voxel] != TYPE_AIR) {
+          break;
+        }
+        const int writable = unshareVoxel(world, voxels, voxel, x, y, z);
+        if (writable != -1) {
+          voxels->light[writable * LIGHT_STRIDE + VOXEL_SUNLIGHT] = maxLight;
         }
       }
+      int neighborsHeight = -1;
+      for (unsigned char n = 1; n < 5; n++) {
+        const int nx = x + neighbors[n * 3],
+                  nz = z + neighbors[n * 3 + 2];
+        if (nx >= 0 && nx < world->width && nz >= 0 && nz < world->depth) {
+          neighborsHeight = fmax(neighborsHeight, heightmap[nz * world->width + nx]);
+        }
+      }
+      for (int sy = y + 1; sy <= neighborsHeight && sy < world->height; sy++) {
+        pushLight(world, queues, &queue, x, sy, z, 0);
+      }
     }
   }
   floodLight(
@@ -217,157 +657,301 @@ void propagate(
     world,
     heightmap,
     voxels,
-    queueA,
-    sunlightQueueSize,
-    queueC
+    queues,
+    &queue
   );
+  // Light sources are seeded in storage order, since the result doesn't depend on it
+  if (world->brickSize) {
+    const int shift = __builtin_ctz(world->brickSize),
+              mask = world->brickSize - 1,
+              cells = 1 << (shift * 3),
+              bricksX = world->width >> shift,
+              bricksY = world->height >> shift,
+              bricks = bricksX * bricksY * (world->depth >> shift);
+    for (int brick = 0; brick < bricks; brick++) {
+      for (int cell = 0; cell < cells; cell++) {
+        // The slot can change when a voxel gets unshared
+        const int slot = world->store ? world->store->bricks[brick] : brick;
+        if (voxels->types[(slot << (shift * 3)) | cell] != TYPE_LIGHT) {
+          continue;
+        }
+        const int x = ((brick % bricksX) << shift) | (cell & mask),
+                  y = (((brick / bricksX) % bricksY) << shift) | ((cell >> shift) & mask),
+                  z = ((brick / (bricksX * bricksY)) << shift) | (cell >> (shift * 2)),
+                  voxel = unshare(world, voxels, x, y, z);
+        if (voxel != -1) {
+          voxels->light[voxel * LIGHT_STRIDE + VOXEL_LIGHT] = maxLight;
+          pushLight(world, queues, &queue, x, y, z, 0);
+        }
+      }
+    }
+  } else {
+    for (int z = 0, voxel = 0; z < world->depth; z++) {
+      for (int y = 0; y < world->height; y++) {
+        for (int x = 0; x < world->width; x++, voxel++) {
+          if (voxels->types[voxel] == TYPE_LIGHT) {
+            voxels->light[voxel * LIGHT_STRIDE + VOXEL_LIGHT] = maxLight;
+            pushLight(world, queues, &queue, x, y, z, 0);
+          }
+        }
+      }
+    }
+  }
   floodLight(
     VOXEL_LIGHT,
     world,
     heightmap,
     voxels,
-    queueB,
-    lightQueueSize,
-    queueC
+    queues,
+    &queue
   );
 }
 
-void update(
+static const bool isInBrush(
+  const unsigned char shape,
+  const int size,
+  const int x,
+  const int y,
+  const int z
+) {
+  // Same as VoxelWorld.getBrush
+  if (shape == BRUSH_BOX) {
+    return abs(x) < size && abs(y) < size && abs(z) < size;
+  }
+  return x * x + y * y + z * z <= size * size * 0.75f;
+}
+
+static const bool isNextToBrush(
+  const unsigned char shape,
+  const int size,
+  const int x,
+  const int y,
+  const int z
+) {
+  for (unsigned char n = 0; n < 6; n++) {
+    if (isInBrush(shape, size, x + neighbors[n * 3], y + neighbors[n * 3 + 1], z + neighbors[n * 3 + 2])) {
+      return true;
+    }
+  }
+  return isInBrush(shape, size, x, y, z);
+}
+
+static const unsigned char getBrushColor(unsigned int* random, const unsigned char color, const float noise) {
+  if (noise == 0) {
+    return color;
+  }
+  // LCG seeded by the brush (so it doesn't touch the rand() state of the rest of the engine)
+  *random = *random * 1664525u + 1013904223u;
+  return fmin(fmax((color / 255.0f + ((*random >> 8) / 16777215.0f - 0.5f) * noise) * 255.0f, 0), 0xFF);
+}
+
+// Worst case of the bricks that a brush can write in the sparse storage:
+// The light changes reach maxLight voxels around it and the sunlight ones
+// can go all the way down the columns. Makes sure there's a free slot for every
+// shared brick in there (compacting the store if needed), so a brush never runs out
+// of them halfway through.
+static const bool reserveSlots(
+  const World* world,
+  const Voxels* voxels,
+  const int fromX,
+  const int fromZ,
+  const int toX,
+  const int toY,
+  const int toZ
+) {
+  VoxelStore* store = world->store;
+  if (store == NULL) {
+    return true;
+  }
+  const int shift = __builtin_ctz(world->brickSize),
+            minX = fmax(fromX - maxLight, 0) / world->brickSize,
+            minZ = fmax(fromZ - maxLight, 0) / world->brickSize,
+            maxX = fmin(toX + maxLight, world->width - 1) / world->brickSize,
+            maxY = fmin(toY + maxLight, world->height - 1) / world->brickSize,
+            maxZ = fmin(toZ + maxLight, world->depth - 1) / world->brickSize;
+  for (int attempt = 0; attempt < 2; attempt++) {
+    int needed = 0;
+    for (int bz = minZ; bz <= maxZ; bz++) {
+      for (int by = 0; by <= maxY; by++) {
+        for (int bx = minX; bx <= maxX; bx++) {
+          if (store->references[store->bricks[getBrick(world, bx << shift, by << shift, bz << shift)]] > 1) {
+            needed++;
+          }
+        }
+      }
+    }
+    if (store->capacity - store->used >= needed) {
+      return true;
+    }
+    if (attempt == 0) {
+      compact(world, voxels);
+    }
+  }
+  return false;
+}
+
+const int brush(
   const World* world,
   int* heightmap,
-  unsigned char* voxels,
-  int* queueA,
-  int* queueB,
-  int* queueC,
+  const Voxels* voxels,
+  LightQueues* queues,
+  const unsigned char shape,
+  const int size,
   const unsigned char type,
   const int x,
   const int y,
   const int z,
   const unsigned char r,
   const unsigned char g,
-  const unsigned char b
+  const unsigned char b,
+  const float noise,
+  const int seed
 ) {
-  if (
-    x < 1 || x >= world->width - 1
-    || y < 1 || y >= world->height - 1
-    || z < 1 || z >= world->depth - 1
-  ) {
-    return;
+  const int radius = shape == BRUSH_BOX ? size - 1 : size,
+            fromX = fmax(x - radius, 1),
+            fromY = fmax(y - radius, 1),
+            fromZ = fmax(z - radius, 1),
+            toX = fmin(x + radius, world->width - 2),
+            toY = fmin(y + radius, world->height - 2),
+            toZ = fmin(z + radius, world->depth - 2);
+  if (radius < 0 || fromX > toX || fromY > toY || fromZ > toZ) {
+    return 0;
   }
-  const int voxel = getVoxel(world, x, y, z);
-  const unsigned char current = voxels[voxel];
-  voxels[voxel] = type;
-  voxels[voxel + VOXEL_R] = r;
-  voxels[voxel + VOXEL_G] = g;
-  voxels[voxel + VOXEL_B] = b;
-  if (current == type) {
-    return;
+  if (!reserveSlots(world, voxels, fromX, fromZ, toX, toY, toZ)) {
+    return -1;
   }
-  const int heightmapIndex = z * world->width + x;
-  const int height = heightmap[heightmapIndex];
-  if (type == TYPE_AIR) {
-    if (y == height) {
-      for (int h = y - 1; h >= 0; h--) {
-        if (h == 0 || voxels[getVoxel(world, x, h, z)] != TYPE_AIR) {
-          heightmap[heightmapIndex] = h;
-          break;
+  const float colorNoise = ((r + g + b) / (3.0f * 255.0f)) * noise;
+  unsigned int random = seed;
+  bool changed = false;
+  for (int vz = fromZ; vz <= toZ; vz++) {
+    for (int vy = fromY; vy <= toY; vy++) {
+      for (int vx = fromX; vx <= toX; vx++) {
+        if (!isInBrush(shape, size, vx - x, vy - y, vz - z)) {
+          continue;
         }
+        const int voxel = unshare(world, voxels, vx, vy, vz);
+        if (voxel == -1) {
+          continue;
+        }
+        if (voxels->types[voxel] != type) {
+          changed = true;
+          markChunks(world, vx, vy, vz, CHUNK_MESH | CHUNK_COLLIDERS);
+        } else {
+          markChunks(world, vx, vy, vz, CHUNK_MESH);
+        }
+        voxels->types[voxel] = type;
+        voxels->colors[voxel * COLORS_STRIDE + VOXEL_R] = getBrushColor(&random, r, colorNoise);
+        voxels->colors[voxel * COLORS_STRIDE + VOXEL_G] = getBrushColor(&random, g, colorNoise);
+        voxels->colors[voxel * COLORS_STRIDE + VOXEL_B] = getBrushColor(&random, b, colorNoise);
       }
     }
-  } else if (height < y) {
-    heightmap[heightmapIndex] = y;
-  }
-  if (current == TYPE_LIGHT) {
-    const unsigned char light = voxels[voxel + VOXEL_LIGHT];
-    voxels[voxel + VOXEL_LIGHT] = 0;
-    queueA[0] = voxel;
-    queueA[1] = light;
-    removeLight(
-      VOXEL_LIGHT,
-      world,
-      heightmap,
-      voxels,
-      queueA,
-      2,
-      queueB,
-      queueC,
-      0
-    );
-  } else if (current == TYPE_AIR && type != TYPE_AIR) {
-    for (unsigned char channel = VOXEL_LIGHT; channel <= VOXEL_SUNLIGHT; channel++) {
-      const unsigned char light = voxels[voxel + channel];
-      if (light != 0) {
-        voxels[voxel + channel] = 0;
-        queueA[0] = voxel;
-        queueA[1] = light;
-        removeLight(
-          channel,
-          world,
-          heightmap,
-          voxels,
-          queueA,
-          2,
-          queueB,
-          queueC,
-          0
-        );
+  }
+  if (!changed) {
+    return 0;
+  }
+  for (int vz = fromZ; vz <= toZ; vz++) {
+    for (int vx = fromX; vx <= toX; vx++) {
+      const int heightmapIndex = vz * world->width + vx;
+      int height = fmax(heightmap[heightmapIndex], toY);
+      while (height > 0 && voxels->types[getVoxel(world, vx, height, vz)] == TYPE_AIR) {
+        height--;
       }
+      heightmap[heightmapIndex] = height;
     }
   }
-  if (type == TYPE_LIGHT) {
-    voxels[voxel + VOXEL_LIGHT] = maxLight;
-    queueA[0] = voxel;
-    floodLight(
-      VOXEL_LIGHT,
-      world,
-      heightmap,
-      voxels,
-      queueA,
-      1,
-      queueB
-    );
-  } else if (type == TYPE_AIR && current != TYPE_AIR) {
-    unsigned int lightQueue = 0;
-    unsigned int sunlightQueue = 0;
-    for (unsigned char n = 0; n < 6; n++) {
-      const int neighbor = getVoxel(
-        world,
-        x + neighbors[n * 3],
-        y + neighbors[n * 3 + 1],
-        z + neighbors[n * 3 + 2]
-      );
-      if (neighbor != -1) {
-        if (voxels[neighbor + VOXEL_LIGHT] != 0) {
-          queueA[lightQueue++] = neighbor;
-        }
-        if (voxels[neighbor + VOXEL_SUNLIGHT] != 0) {
-          queueB[sunlightQueue++] = neighbor;
+  // All the voxels are written before touching the light, so the removals
+  // and the floods of the whole brush are merged into a single pass per channel.
+  LightQueue removalQueue = createLightQueue(queues->queue, queues->pending, queues->capacity, 2);
+  LightQueue floodQueue = createLightQueue(queues->seeds, queues->pendingSeeds, queues->capacity, 1);
+  for (unsigned char channel = VOXEL_LIGHT; channel <= VOXEL_SUNLIGHT; channel++) {
+    for (int vz = fromZ; vz <= toZ; vz++) {
+      for (int vy = fromY; vy <= toY; vy++) {
+        for (int vx = fromX; vx <= toX; vx++) {
+          if (!isInBrush(shape, size, vx - x, vy - y, vz - z)) {
+            continue;
+          }
+          const int voxel = getVoxel(world, vx, vy, vz);
+          const unsigned char voxelType = voxels->types[voxel],
+                              light = voxels->light[voxel * LIGHT_STRIDE + channel];
+          if (channel == VOXEL_LIGHT && voxelType == TYPE_LIGHT) {
+            // A new source only raises the light around it
+            if (light != maxLight) {
+              const int writable = unshareVoxel(world, voxels, voxel, vx, vy, vz);
+              if (writable != -1) {
+                voxels->light[writable * LIGHT_STRIDE + channel] = maxLight;
+                pushLight(world, queues, &floodQueue, vx, vy, vz, 0);
+              }
+            }
+            continue;
+          }
+          // Solid voxels don't hold light and air only holds maxLight from a source (that was just removed)
+          if (
+            light != 0
+            && (voxelType != TYPE_AIR || (channel == VOXEL_LIGHT && light == maxLight))
+          ) {
+            const int writable = unshareVoxel(world, voxels, voxel, vx, vy, vz);
+            if (writable != -1 && pushLight(world, queues, &removalQueue, vx, vy, vz, light)) {
+              voxels->light[writable * LIGHT_STRIDE + channel] = 0;
+            }
+          }
         }
       }
     }
-    if (lightQueue > 0) {
-      floodLight(
-        VOXEL_LIGHT,
-        world,
-        heightmap,
-        voxels,
-        queueA,
-        lightQueue,
-        queueC
-      );
-    }
-    if (sunlightQueue > 0) {
-      floodLight(
-        VOXEL_SUNLIGHT,
-        world,
-        heightmap,
-        voxels,
-        queueB,
-        sunlightQueue,
-        queueC
-      );
+    if (type == TYPE_AIR) {
+      // Flood the new air from the lit voxels in and around it
+      for (int vz = fromZ - 1; vz <= toZ + 1; vz++) {
+        for (int vy = fromY - 1; vy <= toY + 1; vy++) {
+          for (int vx = fromX - 1; vx <= toX + 1; vx++) {
+            if (!isNextToBrush(shape, size, vx - x, vy - y, vz - z)) {
+              continue;
+            }
+            const int voxel = getVoxel(world, vx, vy, vz);
+            if (voxels->light[voxel * LIGHT_STRIDE + channel] != 0) {
+              pushLight(world, queues, &floodQueue, vx, vy, vz, 0);
+            }
+          }
+        }
+      }
     }
+    removeLight(
+      channel,
+      world,
+      heightmap,
+      voxels,
+      queues,
+      &removalQueue,
+      &floodQueue
+    );
   }
+  return 0;
+}
+
+const int update(
+  const World* world,
+  int* heightmap,
+  const Voxels* voxels,
+  LightQueues* queues,
+  const unsigned char type,
+  const int x,
+  const int y,
+  const int z,
+  const unsigned char r,
+  const unsigned char g,
+  const unsigned char b
+) {
+  return brush(
+    world,
+    heightmap,
+    voxels,
+    queues,
+    BRUSH_BOX,
+    1,
+    type,
+    x, y, z,
+    r, g, b,
+    0,
+    0
+  );
 }
 
 int getHeight(
@@ -387,7 +971,7 @@ int getHeight(
 
 unsigned short getLight(
   const World* world,
-  unsigned char* voxels,
+  const Voxels* voxels,
   const int x,
   const int y,
   const int z
@@ -401,8 +985,8 @@ unsigned short getLight(
   }
   const int voxel = getVoxel(world, x, y, z);
   return (
-    (((unsigned char) ((float) voxels[voxel + VOXEL_LIGHT] / maxLight * 0xFF)) << 8)
-    | ((unsigned char) ((float) voxels[voxel + VOXEL_SUNLIGHT] / maxLight * 0xFF))
+    (((unsigned char) ((float) voxels->light[voxel * LIGHT_STRIDE + VOXEL_LIGHT] / maxLight * 0xFF)) << 8)
+    | ((unsigned char) ((float) voxels->light[voxel * LIGHT_STRIDE + VOXEL_SUNLIGHT] / maxLight * 0xFF))
   );
 }
 
@@ -0,0 +1,408 @@
+#ifndef VOXELS_H
+#define VOXELS_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum BlockTypes {
+  TYPE_AIR,
+  TYPE_DIRT,
+  TYPE_LIGHT,
+  TYPE_STONE,
+  TYPE_TREE
+};
+
+enum VoxelColorFields {
+  VOXEL_R,
+  VOXEL_G,
+  VOXEL_B,
+  COLORS_STRIDE
+};
+
+enum VoxelLightFields {
+  VOXEL_LIGHT,
+  VOXEL_SUNLIGHT,
+  LIGHT_STRIDE
+};
+
+enum BrushShapes {
+  BRUSH_BOX,
+  BRUSH_SPHERE
+};
+
+enum Generators {
+  GENERATOR_BLANK,
+  GENERATOR_DEFAULT,
+  GENERATOR_MENU,
+  GENERATOR_DEBUG_CITY,
+  GENERATOR_PARTY_BUILDINGS,
+  GENERATOR_PIT,
+  GENERATOR_SCULPT
+};
+
+// Sparse storage: Bricks point to slots of a pool. Uniform bricks
+// (all voxels equal, like the sky or the empty space) share a single read-only
+// slot until they get written, when they are copied into a free one.
+// The caller can move the pool into a bigger one between calls when it runs out of slots.
+typedef struct {
+  int* const bricks;     // Slot of every brick
+  int* const references; // Bricks pointing to every slot (0: free)
+  int* const scratch;    // capacity ints (used by compact)
+  const int capacity;    // Slots in the pool
+  int used;              // Slots in use
+  int overflow;          // Writes dropped because the pool was full
+  int next;              // Where to start looking for a free slot
+} VoxelStore;
+
+enum ChunkFlags {
+  CHUNK_MESH = 1,      // Voxel types or colors changed in or next to the chunk
+  CHUNK_COLLIDERS = 2, // Voxel types changed in the chunk
+  CHUNK_LIGHT = 4      // Light changed in or next to the chunk (see relight)
+};
+
+enum SweepContacts {
+  SWEEP_WALL = 1,    // Blocked along x or z
+  SWEEP_GROUND = 2,  // Blocked moving down (or resting on a voxel, when not moving up)
+  SWEEP_CEILING = 4, // Blocked moving up
+  SWEEP_STEP = 8     // Stepped up onto a ledge
+};
+
+// Chunks changed by brush & update
+// (the caller reads the list and zeroes the flags & the count of the chunks it handled)
+typedef struct {
+  unsigned char* const chunks; // ChunkFlags of every chunk
+  int* const list;             // Indices of the chunks with any flag (in the order they got it)
+  const int chunkSize;
+  const int margin;            // Voxels around their chunk the meshes read (1, or 1 << lod when meshing downsampled)
+  int count;
+} DirtyChunks;
+
+typedef struct {
+  const int width;
+  const int height;
+  const int depth;
+  const int seaLevel;
+  // 0: Linear layout (z * width * height + y * width + x)
+  // Power of two: Bricked layout. Every brickSize^3 brick is stored contiguously.
+  //               (width, height & depth must be multiples of it)
+  const int brickSize;
+  // NULL: Every brick is stored in place
+  // Otherwise: Sparse storage (requires the bricked layout)
+  VoxelStore* const store;
+  // NULL: Changed chunks are not tracked
+  DirtyChunks* const dirty;
+} World;
+
+// Voxel fields are stored as separate planes, indexed by getVoxel:
+//  types:  type
+//  colors: r, g, b (COLORS_STRIDE per voxel)
+//  light:  light, sunlight (LIGHT_STRIDE per voxel)
+typedef struct {
+  unsigned char* const types;
+  unsigned char* const colors;
+  unsigned char* const light;
+} Voxels;
+
+// Light propagation queues (used by brush, propagate & update)
+typedef struct {
+  int* const queue;                  // capacity ints
+  int* const seeds;                  // capacity ints
+  unsigned char* const pending;      // width * height * depth bits (zeroed)
+  unsigned char* const pendingSeeds; // width * height * depth bits (zeroed)
+  const int capacity;
+  // Stats
+  unsigned int nodes;    // Nodes processed
+  unsigned int deferred; // Nodes that didn't fit in the queues (they get processed once it drains)
+} LightQueues;
+
+#ifdef VOXELS_COUNTERS
+// Work done by the mesher & relight, for the benchmark (cmake -DVOXELS_COUNTERS=ON).
+// They only add up: the caller zeroes them.
+typedef struct {
+  unsigned long long corners; // Face corners that got their light & AO computed
+  unsigned long long reads;   // Neighborhood reads for it (including the lookups of the corner cache)
+} VoxelsCounters;
+
+extern VoxelsCounters voxelsCounters;
+#endif
+
+// All the buffers are owned by the caller:
+//  voxels:    cells (types), cells * COLORS_STRIDE (colors) & cells * LIGHT_STRIDE (light)
+//             cells: width * height * depth (in the world->brickSize layout)
+//                    or store->capacity * brickSize^3 (sparse storage)
+//  bricks:    (width / brickSize) * (height / brickSize) * (depth / brickSize) (sparse storage)
+//  obstacles: width * height * depth bits (always in the linear layout)
+//  heightmap: width * depth
+//  neighbors: (chunkSize + 2)^2 * ceil((chunkSize + 2) / 64) * 8 + (chunkSize + 2)^3 * (1 + LIGHT_STRIDE)
+//             + (chunkSize + 2)^2 * ceil((chunkSize + 2) / 64) * 16 + (chunkSize + 2)^2 * 4
+//             + (chunkSize + 1)^2 * 48 + (chunkSize + 1) * ceil((chunkSize + 1) / 64) * 96
+//             (mesh scratch, 8 bytes aligned)
+//  dirty:     (width / chunkSize) * (height / chunkSize) * (depth / chunkSize) (chunks & list)
+//  queues:    width * depth * 3 (generate & LightQueues capacity)
+// See core/voxels.js for the sizes of the rest of the buffers.
+
+// Applies a whole brush and then updates the light of all of it at once
+// (noise: 0-1 random variation of the color, seeded by seed).
+// Returns -1 without writing anything if the sparse store doesn't have enough free slots
+// for the worst case of the brush (even after compacting it).
+const int brush(
+  const World* world,
+  int* heightmap,
+  const Voxels* voxels,
+  LightQueues* queues,
+  const unsigned char shape,
+  const int size,
+  const unsigned char type,
+  const int x,
+  const int y,
+  const int z,
+  const unsigned char r,
+  const unsigned char g,
+  const unsigned char b,
+  const float noise,
+  const int seed
+);
+
+void clear(
+  const World* world,
+  const Voxels* voxels
+);
+
+// Outputs the boxes (x, y, z, width, height, depth) that cover the solid voxels of a chunk
+// and a hash of them (the same boxes always get the same hash).
+// rows is scratch space for chunkSize^2 * ceil(chunkSize / 64) words, it doesn't need clearing.
+// The chunk can overhang the edges of the world (that part of it is air).
+// Returns the boxes (-1: the origin is out of bounds).
+const int colliders(
+  const World* world,
+  const Voxels* voxels,
+  unsigned char* colliders,
+  unsigned int* hash,
+  unsigned long long* rows,
+  const unsigned char chunkSize,
+  const int chunkX,
+  const int chunkY,
+  const int chunkZ
+);
+
+void compact(
+  const World* world,
+  const Voxels* voxels
+);
+
+const int findGround(
+  const World* world,
+  const int* heightmap,
+  const Voxels* voxels,
+  const bool avoidTrees,
+  const int height,
+  const int x,
+  int y,
+  const int z
+);
+
+const int findPath(
+  const World* world,
+  const Voxels* voxels,
+  const unsigned char* obstacles,
+  int* results,
+  const int height,
+  const int fromX,
+  const int fromY,
+  const int fromZ,
+  const int toX,
+  const int toY,
+  const int toZ
+);
+
+const unsigned char findTarget(
+  const World* world,
+  const int* heightmap,
+  const Voxels* voxels,
+  const unsigned char* obstacles,
+  int* point,
+  const int height,
+  const int radius,
+  const int originX,
+  const int originY,
+  const int originZ
+);
+
+void generate(
+  const World* world,
+  int* heightmap,
+  const Voxels* voxels,
+  int* queueA,
+  int* queueB,
+  const unsigned char generator,
+  const int seed
+);
+
+int getHeight(
+  const World* world,
+  const int* heightmap,
+  const int x,
+  const int z
+);
+
+unsigned short getLight(
+  const World* world,
+  const Voxels* voxels,
+  const int x,
+  const int y,
+  const int z
+);
+
+void heightmap(
+  const World* world,
+  int* heightmap,
+  const Voxels* voxels
+);
+
+// Outputs 4 vertices per face (x, y, z, r, g, b, light, sunlight), which are
+// always drawn as the triangles 0, 1, 2 & 2, 3, 0. Returns the faces.
+// The faces are grouped by direction (top, bottom, south, north, east, west)
+// and directions gets the faces of each one, so the ones facing away can be skipped.
+// connections gets the pairs of chunk sides (in the same order) connected through the air
+// inside the chunk: bit (a * 6 + b) for every pair a < b (for occlusion culling).
+const int mesh(
+  const World* world,
+  const Voxels* voxels,
+  float* bounds,
+  int* directions,
+  int* connections,
+  unsigned char* vertices,
+  unsigned char* neighbors,
+  const unsigned char chunkSize,
+  const bool greedy, // Merge the coplanar faces with the same color & light
+  const unsigned char lod, // Level of detail: 0 (full), 1 (2x) or 2 (4x downsampled)
+  const int chunkX,
+  const int chunkY,
+  const int chunkZ
+);
+
+// Meshes a list of chunks (x, y, z of their origins & lod) one after the other into the same
+// vertices, which hold capacity faces. Every chunk gets its bounds, its first face
+// & faces (-1: out of bounds) in faces, the faces of every direction in directions
+// and its connections.
+// Returns the chunks that got meshed (it stops before any chunk that might not fit).
+const int meshChunks(
+  const World* world,
+  const Voxels* voxels,
+  float* bounds,
+  int* faces,
+  int* directions,
+  int* connections,
+  unsigned char* vertices,
+  unsigned char* neighbors,
+  const int* chunks,
+  const int count,
+  const int capacity,
+  const unsigned char chunkSize,
+  const bool greedy
+);
+
+void propagate(
+  const World* world,
+  const int* heightmap,
+  const Voxels* voxels,
+  LightQueues* queues
+);
+
+// Walks the voxels along a ray (in voxels, with a normalized direction) up to maxDistance.
+// Outputs the hit voxel (x, y, z) and the normal of the face the ray entered it through (x, y, z).
+// Returns the distance to the hit (-1: no hit).
+const float raycast(
+  const World* world,
+  const Voxels* voxels,
+  int* hit,
+  const float originX,
+  const float originY,
+  const float originZ,
+  const float directionX,
+  const float directionY,
+  const float directionZ,
+  const float maxDistance
+);
+
+// Recomputes the light of the vertices of a chunk that was meshed (with the same lod)
+// before a change that only affected the light (no CHUNK_MESH flag).
+// It only reads the positions of the vertices and outputs their light & sunlight
+// into light (faces * 4 * LIGHT_STRIDE), so the caller only has to update that.
+// Returns the faces or -1 if it can't (out of bounds or merged faces): remesh it instead.
+const int relight(
+  const World* world,
+  const Voxels* voxels,
+  const unsigned char* vertices,
+  unsigned char* light,
+  unsigned char* neighbors,
+  const int faces,
+  const unsigned char chunkSize,
+  const unsigned char lod,
+  const int chunkX,
+  const int chunkY,
+  const int chunkZ
+);
+
+// Moves a box (in voxels) against the solid voxels (outside the world is air).
+// position is the center of the bottom of the box and gets updated with where it ends up.
+// The box is radius * 2 wide & deep and height tall. stepHeight: highest ledge it can step onto.
+// Returns the SweepContacts of the move.
+const int sweep(
+  const World* world,
+  const Voxels* voxels,
+  float* position,
+  const float radius,
+  const float height,
+  const float stepHeight,
+  const float moveX,
+  const float moveY,
+  const float moveZ
+);
+
+// Copies the voxels of the [fromZ, toZ) slices between the storage and linear
+// (the saved & networked format): the linear layout with the fields interleaved
+// (type, r, g, b, light, sunlight). linear only holds those slices.
+// When loading into the sparse storage, the slices must cover whole bricks and
+// the world must be cleared first (it only unshares the bricks that are not empty).
+// Returns -1 if the slices are out of bounds or the store ran out of slots.
+const int transcode(
+  const World* world,
+  const Voxels* voxels,
+  unsigned char* linear,
+  const bool toLinear,
+  const int fromZ,
+  const int toZ
+);
+
+const int unshare(
+  const World* world,
+  const Voxels* voxels,
+  const int x,
+  const int y,
+  const int z
+);
+
+// Same as a box brush of size 1 (returns -1 like brush)
+const int update(
+  const World* world,
+  int* heightmap,
+  const Voxels* voxels,
+  LightQueues* queues,
+  const unsigned char type,
+  const int x,
+  const int y,
+  const int z,
+  const unsigned char r,
+  const unsigned char g,
+  const unsigned char b
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
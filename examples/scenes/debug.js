@@ -34,6 +34,7 @@ class Debug extends Gameplay {
         depth: 400,
         generator: 'debugCity',
         seed: 987654321,
+        lodDistances: [96, 192],
         onContact: (contact) => {
           if (this.projectiles.destroyOnContact(contact)) {
             this.updateVoxel(
@@ -106,22 +107,21 @@ class Debug extends Gameplay {
     if (!isXR) {
       const { buttons, raycaster } = player.desktop;
       if (dudes.selected && buttons.primaryDown) {
-        const hit = physics.raycast(raycaster.ray.origin, raycaster.ray.direction);
+        const hit = world.raycast(raycaster.ray.origin, raycaster.ray.direction);
         if (hit) {
-          hit.point
-            .divideScalar(world.scale)
-            .addScaledVector(hit.normal, 0.25)
-            .floor();
+          const voxel = new Vector3()
+            .copy(hit.voxel)
+            .add(hit.normal);
           if (server) {
             server.request({
               type: 'TARGET',
               id: dudes.selected.serverId,
-              voxel: hit.point,
+              voxel,
             });
           }
           dudes.setDestination(
             dudes.selected,
-            hit.point
+            voxel
           );
           return;
         }
@@ -169,7 +169,7 @@ class Debug extends Gameplay {
         return;
       }
       if (isXR && hand && (buttons.primary || buttons.primaryUp)) {
-        const hit = physics.raycast(raycaster.ray.origin, raycaster.ray.direction);
+        const hit = world.raycast(raycaster.ray.origin, raycaster.ray.direction);
         if (hit) {
           pointer.update({
             distance: hit.distance,
@@ -190,7 +190,7 @@ class Debug extends Gameplay {
       );
       if (isPlacing || isRemoving) {
         const hit = isXR ? pointer.target : (
-          physics.raycast(raycaster.ray.origin, raycaster.ray.direction)
+          world.raycast(raycaster.ray.origin, raycaster.ray.direction)
         );
         if (!hit) {
           return;
@@ -210,10 +210,9 @@ class Debug extends Gameplay {
             ...brush,
             type: isRemoving ? 'air' : brush.type,
           },
-          hit.point
-            .divideScalar(world.scale)
-            .addScaledVector(hit.normal, isRemoving ? -0.25 : 0.25)
-            .floor()
+          new Vector3()
+            .copy(hit.voxel)
+            .addScaledVector(hit.normal, isRemoving ? 0 : 1)
         );
       }
     });
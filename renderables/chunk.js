@@ -8,8 +8,11 @@ import {
   ShaderMaterial,
   Sphere,
   UniformsUtils,
+  Vector3,
 } from '../vendor/three.js';
 
+const _camera = new Vector3();
+
 class VoxelChunk extends Mesh {
   static setupMaterial() {
     const { uniforms, vertexShader, fragmentShader } = ShaderLib.basic;
@@ -52,8 +55,9 @@ class VoxelChunk extends Mesh {
     if (!VoxelChunk.material) {
       VoxelChunk.setupMaterial();
     }
-    super(new BufferGeometry(), VoxelChunk.material);
-    if (geometry && geometry.indices.length > 0) {
+    // A group per axis (y, z, x), so the directions facing away from the camera can be skipped
+    super(new BufferGeometry(), [VoxelChunk.material, VoxelChunk.material, VoxelChunk.material]);
+    if (geometry && geometry.vertices.length > 0) {
       this.update(geometry);
     }
     this.position.set(x, y, z).multiplyScalar(scale);
@@ -62,18 +66,112 @@ class VoxelChunk extends Mesh {
     this.matrixAutoUpdate = false;
   }
 
+  // All the chunks share the same index, since every quad is drawn
+  // with the same pattern (0, 1, 2, 2, 3, 0) after its first vertex.
+  // When it grows, the chunks move to the new one as they get updated
+  // and the last one using the old one disposes it (see releaseIndex).
+  static getIndex(faces) {
+    if (!VoxelChunk.index || VoxelChunk.index.count < faces * 6) {
+      let size = VoxelChunk.index ? VoxelChunk.index.count / 6 : 1024;
+      while (size < faces) size *= 2;
+      const indices = new ((size * 4 - 1) <= 65535 ? Uint16Array : Uint32Array)(size * 6);
+      for (let face = 0, index = 0, vertex = 0; face < size; face += 1, index += 6, vertex += 4) {
+        indices[index] = vertex;
+        indices[index + 1] = vertex + 1;
+        indices[index + 2] = vertex + 2;
+        indices[index + 3] = vertex + 2;
+        indices[index + 4] = vertex + 3;
+        indices[index + 5] = vertex;
+      }
+      VoxelChunk.index = new BufferAttribute(indices, 1);
+      VoxelChunk.index.chunks = 0;
+    }
+    return VoxelChunk.index;
+  }
+
   dispose() {
     const { geometry } = this;
+    this.releaseIndex();
     geometry.dispose();
   }
 
-  update({ bounds, indices, vertices }) {
-    const { geometry } = this;
+  // Detaches the shared index unless this was the last chunk using an outgrown one.
+  // In that case it's left in place, so disposing the geometry disposes it too.
+  releaseIndex() {
+    const { geometry: { index } } = this;
+    if (!index) {
+      return;
+    }
+    index.chunks -= 1;
+    if (index === VoxelChunk.index || index.chunks > 0) {
+      this.geometry.setIndex(null);
+    }
+  }
+
+  // Recomputes the light of the vertices, with relight(vertices, light) writing it into the light buffer
+  // (the light in the interleaved vertices is only read by update, so it's left as it was)
+  // Returns false if relight couldn't (and the chunk needs to be remeshed)
+  updateLight(relight) {
+    const { vertices } = this;
+    const light = this.geometry.getAttribute('light');
+    if (!light || !relight(vertices.array, light.array)) {
+      return false;
+    }
+    light.needsUpdate = true;
+    return true;
+  }
+
+  // Draws only the directions of the group axis that can face the camera
+  onBeforeRender(renderer, scene, camera, geometry, material, group) {
+    const { boundingSphere: { center, radius } } = geometry;
+    const { directions } = this;
+    const axis = group.materialIndex;
+    const component = VoxelChunk.axes[axis];
+    const positive = directions[axis * 2];
+    const negative = directions[axis * 2 + 1];
+    _camera.setFromMatrixPosition(camera.matrixWorld);
+    this.worldToLocal(_camera);
+    const start = _camera[component] < center[component] - radius ? positive : 0;
+    const end = _camera[component] > center[component] + radius ? positive : positive + negative;
+    geometry.setDrawRange(group.start + start * 6, (end - start) * 6);
+  }
+
+  onAfterRender(renderer, scene, camera, geometry) {
+    geometry.setDrawRange(0, Infinity);
+  }
+
+  update({ bounds, directions, vertices }) {
+    let { geometry } = this;
+    const faces = vertices.length / 32;
+    const index = VoxelChunk.getIndex(faces);
+    if (geometry.index !== index) {
+      if (geometry.index) {
+        // Moving off an outgrown index: Start over with a new geometry,
+        // since the renderer only frees the buffers of the disposed ones.
+        this.dispose();
+        geometry = new BufferGeometry();
+        this.geometry = geometry;
+      }
+      index.chunks += 1;
+      geometry.setIndex(index);
+    }
+    const light = new Uint8Array(faces * 4 * 2);
+    VoxelChunk.copyLight(vertices, light);
     vertices = new InterleavedBuffer(vertices, 8);
-    geometry.setIndex(new BufferAttribute(indices, 1));
+    this.vertices = vertices;
+    geometry.clearGroups();
+    for (let axis = 0, start = 0; axis < 3; axis += 1) {
+      const count = directions[axis * 2] + directions[axis * 2 + 1];
+      if (count > 0) {
+        geometry.addGroup(start * 6, count * 6, axis);
+      }
+      start += count;
+    }
+    this.directions = directions;
     geometry.setAttribute('position', new InterleavedBufferAttribute(vertices, 3, 0));
     geometry.setAttribute('color', new InterleavedBufferAttribute(vertices, 3, 3));
-    geometry.setAttribute('light', new InterleavedBufferAttribute(vertices, 2, 6));
+    // The light gets its own buffer, so relighting only uploads the light
+    geometry.setAttribute('light', new BufferAttribute(light, 2));
     if (geometry.boundingSphere === null) {
       geometry.boundingSphere = new Sphere();
     }
@@ -81,4 +179,16 @@ class VoxelChunk extends Mesh {
   }
 }
 
+// Copies the light out of the interleaved vertices
+VoxelChunk.copyLight = (vertices, light) => {
+  for (let i = 0, j = 6, l = light.length; i < l; i += 2, j += 8) {
+    light[i] = vertices[j];
+    light[i + 1] = vertices[j + 1];
+  }
+};
+
+// Axis of every group, with its directions in the order of the mesher
+// (top & bottom, south & north, east & west)
+VoxelChunk.axes = ['y', 'z', 'x'];
+
 export default VoxelChunk;
@@ -161,11 +161,12 @@ class Dudes {
           ) {
             return;
           }
-          obstacles[
+          const index = (
             position.z * server.world.width * server.world.height
             + (position.y + y) * server.world.width
             + position.x
-          ] = 1;
+          );
+          obstacles[index >> 3] |= 1 << (index & 7);
         }
       }
     }, []);
@@ -42,14 +42,9 @@ class VoxelServer {
       ...options.world,
       onLoad: () => {
         if (this.storage && fs.existsSync(this.storage)) {
-          this.world.voxels.view.set(
+          this.world.deserialize(
             zlib.inflateSync(fs.readFileSync(this.storage))
           );
-          this.world._heightmap(
-            this.world.world.address,
-            this.world.heightmap.address,
-            this.world.voxels.address
-          );
         } else {
           this.world.generate();
         }
@@ -61,7 +56,7 @@ class VoxelServer {
 
   onClient(client) {
     const { clients, dudes, pingInterval, world } = this;
-    zlib.deflate(world.voxels.view, (err, voxels) => {
+    zlib.deflate(world.serialize(), (err, voxels) => {
       if (err) {
         client.terminate();
         return;
@@ -183,24 +178,22 @@ class VoxelServer {
         if (brush.size <= 0 || brush.size > 4) {
           return;
         }
-        const r = ((brush.color >> 16) & 0xFF) / 0xFF;
-        const g = ((brush.color >> 8) & 0xFF) / 0xFF;
-        const b = (brush.color & 0xFF) / 0xFF;
-        const noise = ((r + g + b) / 3) * brush.noise;
-        VoxelWorld.getBrush({
+        if (!brush.seed) {
+          brush.seed = VoxelWorld.brushSeed();
+        }
+        world.brush({
           shape: brush.shape,
           size: brush.size,
-        }).forEach(({ x, y, z }) => (
-          world.update({
-            x: voxel.x + x,
-            y: voxel.y + y,
-            z: voxel.z + z,
-            type: brush.type,
-            r: Math.min(Math.max((r + (Math.random() - 0.5) * noise) * 0xFF, 0), 0xFF),
-            g: Math.min(Math.max((g + (Math.random() - 0.5) * noise) * 0xFF, 0), 0xFF),
-            b: Math.min(Math.max((b + (Math.random() - 0.5) * noise) * 0xFF, 0), 0xFF),
-          })
-        ));
+          type: brush.type,
+          x: voxel.x,
+          y: voxel.y,
+          z: voxel.z,
+          r: (brush.color >> 16) & 0xFF,
+          g: (brush.color >> 8) & 0xFF,
+          b: brush.color & 0xFF,
+          noise: brush.noise,
+          seed: brush.seed,
+        });
         this.broadcast({
           type: 'UPDATE',
           brush,
@@ -260,7 +253,10 @@ class VoxelServer {
         reject();
         return;
       }
-      zlib.deflate(world.voxels.view, (err, voxels) => {
+      // Shares the bricks that became uniform since the last save
+      // (updates only compact the store when they run short of slots)
+      world.compact();
+      zlib.deflate(world.serialize(), (err, voxels) => {
         if (err) {
           reject();
           return;